@@ -2,6 +2,7 @@
 ; HELLO WORLD PROGRAM
 ; Outputs "HELLO, WORLD!" to console
 ; Uses memory-mapped I/O at address 32 (0x20)
+; Letters above 63 assemble to the two-word MOVW
 ; ========================================
 
 ; Initialize I/O port address
@@ -47,7 +48,13 @@ STORE R0, R7     ; memory[R7] = R0
 MOV R0, 82
 STORE R0, R7     ; memory[R7] = R0
 
+; Words 32-33 are the I/O ports, and every character written lands
+; there too: continue past them
+JMP rest
+.org 34
+
 ; Output 'L' (ASCII 76)
+rest:
 MOV R0, 76
 STORE R0, R7     ; memory[R7] = R0
 
@@ -44,17 +44,13 @@ loop:
     ; Increment counter
     ADD R0, 1        ; R0 = R0 + 1
     
-    ; Check if we've reached the limit
-    SUB R4, R0       ; R4 = R0 (copy for comparison)
-    SUB R4, R1       ; R4 = R0 - R1
+    ; Check if we've reached the limit: CMP sets the flags of R0 - R1
+    ; without changing R0
+    CMP R0, R1
     
-    ; If R4 == 0, we've counted to 10
-    JZ done          ; Jump if zero flag is set
-    
-    ; Otherwise, continue looping
-    JMP loop
+    ; Keep looping until we've counted to 10
+    JNZ loop         ; Jump if zero flag is clear
 
-done:
     HALT             ; Stop execution
 
 ; ========================================
@@ -81,7 +77,7 @@ done:
 ;           STORE: R3 = 48
 ;
 ; Cycle 5:  FETCH: IR = ADD R3, R0     IP: 4→5
-;           DECODE: OP=ADD, R1=3, IMM=0
+;           DECODE: OP=ADD, R1=3, R2=1 (register form), IMM=0 (R0)
 ;           EXECUTE: ALU.X=48, ALU.Y=0, OUT=48
 ;                    Flags: ZR=0, NG=0
 ;           STORE: R3 = 48
@@ -0,0 +1,39 @@
+; ========================================
+; WORKLOAD PROGRAM
+; Long-running mix of ALU work, calls and branches for benchmarking
+; ========================================
+; Three nested countdown loops (16 x 63 x 63 iterations) call a small
+; routine that exercises MUL, DIV, AND and OR. About 765,000
+; instructions run before HALT; nothing is printed.
+
+MOV R5, 16       ; R5 = outer counter
+outer:
+    MOV R0, 63       ; R0 = middle counter
+middle:
+    MOV R1, 63       ; R1 = inner counter
+inner:
+    CALL work
+    SUB R1, 1        ; inner--
+    JZ inner_done
+    JMP inner
+inner_done:
+    SUB R0, 1        ; middle--
+    JZ middle_done
+    JMP middle
+middle_done:
+    SUB R5, 1        ; outer--
+    JZ done
+    JMP outer
+done:
+    HALT
+
+; Mixed ALU work on R2-R4; leaves the loop counters alone
+work:
+    MOV R2, 45
+    MOV R3, 7
+    MUL R2, R3       ; R2 = 315
+    DIV R2, R3       ; R2 = 45
+    MOV R4, 60
+    AND R4, R2       ; R4 = 60 & 45
+    OR R4, R3        ; R4 |= 7
+    RET
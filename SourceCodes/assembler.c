@@ -1,64 +1,194 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <ctype.h>
 #include <stdint.h>
 
-#define MAX_LABELS 100
+#include "image.h"
+
 #define MAX_LINE_LENGTH 256
-#define MAX_INSTRUCTIONS 400
 
 typedef uint16_t word_t;
 
 // Label structure for symbol table
 typedef struct {
-    char name[64];
+    char *name;
     int address;
+    int global;         // exported with .global
 } Label;
 
 // Instruction structure
 typedef struct {
     word_t code;
     int line_number;
-    char original[MAX_LINE_LENGTH];
+    char *original;
+    int label;          // label the immediate refers to, or -1
+    int literal;        // the 16-bit immediate word of the MOVW before it
 } Instruction;
 
-Label labels[MAX_LABELS];
-int label_count = 0;
+// Forward reference: a label used before its definition, patched at the end
+typedef struct {
+    int index;          // instruction to patch
+    int line_number;
+    int relocated;      // the linker fills in the address (object mode)
+    char *name;
+} Fixup;
 
-Instruction instructions[MAX_INSTRUCTIONS];
-int instruction_count = 0;
+// Relocation: an instruction whose immediate field takes the final
+// address of a label, filled in by the linker
+typedef struct {
+    int index;
+    char *name;
+} Relocation;
 
-// Opcode mapping
+// Open-addressing hash table from names to array indices
+typedef struct {
+    int *slot;          // index + 1, 0 for an empty slot
+    unsigned capacity;  // power of two
+    unsigned count;
+} SymbolTable;
+
+Label *labels = NULL;
+int label_count = 0, label_capacity = 0;
+SymbolTable label_table;
+
+Instruction *instructions = NULL;
+int instruction_count = 0, instruction_capacity = 0;
+
+Fixup *fixups = NULL;
+int fixup_count = 0, fixup_capacity = 0;
+
+// Relocatable object output (-c): label operands become relocations and
+// labels never defined here are imports
+int object_mode = 0;
+Relocation *relocations = NULL;
+int relocation_count = 0, relocation_capacity = 0;
+char **exports = NULL;
+int export_count = 0, export_capacity = 0;
+
+int error_count = 0;
+int org_used = 0;       // fixed addresses: the optimizer may not move code
+
+// Opcode mapping; variant is the R2 field that names the instruction
+// within its opcode (the branch condition, or 2 for CMP)
 typedef struct {
     const char *mnemonic;
     int opcode;
+    int variant;
 } OpcodeMap;
 
 OpcodeMap opcodes[] = {
-    {"NOP", 0x0}, {"MOV", 0x1}, {"ADD", 0x2}, {"SUB", 0x3},
-    {"AND", 0x4}, {"OR", 0x5},  {"MUL", 0x6}, {"DIV", 0x7},
-    {"JMP", 0x8}, {"JZ", 0x9},  {"CALL", 0xA}, {"RET", 0xB},
-    {"HALT", 0xC}
+    {"NOP", 0x0, 0},  {"MOV", 0x1, 0},  {"ADD", 0x2, 0},   {"SUB", 0x3, 0},
+    {"AND", 0x4, 0},  {"OR", 0x5, 0},   {"MUL", 0x6, 0},   {"DIV", 0x7, 0},
+    {"JMP", 0x8, 0},  {"JZ", 0x9, 0},   {"CALL", 0xA, 0},  {"RET", 0xB, 0},
+    {"HALT", 0xC, 0}, {"LOAD", 0xD, 0}, {"STORE", 0xE, 0}, {"MOVW", 0xF, 0},
+    {"CMP", 0x3, 2},
+    {"JNZ", 0x9, 1}, {"JN", 0x9, 2}, {"JNN", 0x9, 3}, {"JC", 0x9, 4},
+    {"JO", 0x9, 5},  {"JNC", 0x9, 6}, {"DJNZ", 0x9, 7}
 };
 
-// Helper: Find opcode for mnemonic
-int get_opcode(const char *mnemonic) {
-    for (int i = 0; i < sizeof(opcodes) / sizeof(opcodes[0]); i++) {
-        if (strcasecmp(opcodes[i].mnemonic, mnemonic) == 0) {
-            return opcodes[i].opcode;
+#define COND_DJNZ 7     // variant of DJNZ, which takes a register first
+
+SymbolTable opcode_table;
+
+// Helper: Make room for one more element in a growable array
+void *grow(void *array, int count, int *capacity, size_t size) {
+    if (count < *capacity) return array;
+    int new_capacity = *capacity ? *capacity * 2 : 64;
+    array = realloc(array, (size_t)new_capacity * size);
+    if (!array) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    *capacity = new_capacity;
+    return array;
+}
+
+char *copy_string(const char *s) {
+    size_t len = strlen(s) + 1;
+    char *copy = malloc(len);
+    if (!copy) {
+        fprintf(stderr, "Error: Out of memory\n");
+        exit(1);
+    }
+    return memcpy(copy, s, len);
+}
+
+/* ---------------- Symbol table ---------------- */
+
+// FNV-1a; fold_case hashes letters as upper case for mnemonic lookup
+unsigned hash_name(const char *name, int fold_case) {
+    unsigned h = 2166136261u;
+    for (; *name; name++) {
+        h ^= (unsigned char)(fold_case ? toupper((unsigned char)*name) : *name);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Slot holding name, or the empty slot where it would go.
+// key(i) returns the name stored for index i.
+unsigned table_probe(const SymbolTable *t, const char *name, int fold_case,
+                     const char *(*key)(int)) {
+    unsigned mask = t->capacity - 1;
+    unsigned i = hash_name(name, fold_case) & mask;
+
+    while (t->slot[i]) {
+        const char *k = key(t->slot[i] - 1);
+        if (fold_case ? strcasecmp(k, name) == 0 : strcmp(k, name) == 0) break;
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+// Add index under name; the table stays at most half full
+void table_insert(SymbolTable *t, const char *name, int index, int fold_case,
+                  const char *(*key)(int)) {
+    if (2 * (t->count + 1) > t->capacity) {
+        SymbolTable bigger = { NULL, t->capacity ? t->capacity * 2 : 256, 0 };
+        bigger.slot = calloc(bigger.capacity, sizeof(int));
+        if (!bigger.slot) {
+            fprintf(stderr, "Error: Out of memory\n");
+            exit(1);
         }
+        for (unsigned i = 0; i < t->capacity; i++) {
+            if (!t->slot[i]) continue;
+            int old = t->slot[i] - 1;
+            bigger.slot[table_probe(&bigger, key(old), fold_case, key)] = old + 1;
+            bigger.count++;
+        }
+        free(t->slot);
+        *t = bigger;
     }
-    return -1;
+    t->slot[table_probe(t, name, fold_case, key)] = index + 1;
+    t->count++;
+}
+
+// Index stored under name, or -1
+int table_find(const SymbolTable *t, const char *name, int fold_case,
+               const char *(*key)(int)) {
+    if (!t->capacity) return -1;
+    return t->slot[table_probe(t, name, fold_case, key)] - 1;
+}
+
+const char *label_key(int i) { return labels[i].name; }
+const char *opcode_key(int i) { return opcodes[i].mnemonic; }
+
+/* ---------------- Parsing ---------------- */
+
+// Helper: Find opcode (and its variant) for mnemonic
+int get_opcode(const char *mnemonic, int *variant) {
+    int i = table_find(&opcode_table, mnemonic, 1, opcode_key);
+    *variant = i < 0 ? 0 : opcodes[i].variant;
+    return i < 0 ? -1 : opcodes[i].opcode;
 }
 
 // Helper: Parse register number (e.g., "R0" -> 0)
 int parse_register(const char *token) {
-    if (token[0] == 'R' || token[0] == 'r') {
-        int reg = atoi(token + 1);
-        if (reg >= 0 && reg <= 7) {
-            return reg;
-        }
+    if ((token[0] == 'R' || token[0] == 'r') && token[1] >= '0' && token[1] <= '7' &&
+        token[2] == '\0') {
+        return token[1] - '0';
     }
     return -1;
 }
@@ -66,34 +196,89 @@ int parse_register(const char *token) {
 // Helper: Parse immediate value or label reference
 int parse_immediate(const char *token, int *is_label) {
     *is_label = 0;
-    
+
     // Check if it's a number
     if (isdigit(token[0]) || token[0] == '-') {
         return atoi(token);
     }
-    
+
     // It's a label
     *is_label = 1;
-    return 0; // Will be resolved in second pass
+    return 0; // Resolved now if defined, else backpatched at the end
 }
 
 // Helper: Find label address
 int find_label(const char *name) {
-    for (int i = 0; i < label_count; i++) {
-        if (strcmp(labels[i].name, name) == 0) {
-            return labels[i].address;
-        }
-    }
-    return -1;
+    int i = table_find(&label_table, name, 0, label_key);
+    return i < 0 ? -1 : labels[i].address;
 }
 
 // Helper: Add label to symbol table
-void add_label(const char *name, int address) {
-    if (label_count < MAX_LABELS) {
-        strcpy(labels[label_count].name, name);
-        labels[label_count].address = address;
-        label_count++;
+void add_label(const char *name, int address, int line_number) {
+    if (find_label(name) != -1) {
+        fprintf(stderr, "Error on line %d: Duplicate label '%s'\n", line_number, name);
+        error_count++;
+        return;
+    }
+    labels = grow(labels, label_count, &label_capacity, sizeof(Label));
+    labels[label_count].name = copy_string(name);
+    labels[label_count].address = address;
+    labels[label_count].global = 0;
+    table_insert(&label_table, name, label_count, 0, label_key);
+    label_count++;
+}
+
+// Helper: Whether a label's address fits the 6-bit immediate field of an
+// instruction; reports the label when it does not
+int label_fits(const char *name, int address, int line_number) {
+    if (address < 64) return 1;
+    fprintf(stderr, "Error on line %d: Label '%s' is at address %d, beyond the 6-bit "
+            "immediate field (0-63); MOVW takes any address\n", line_number, name, address);
+    error_count++;
+    return 0;
+}
+
+// Helper: Address of a label operand; unknown labels are recorded for
+// backpatching and read as 0 until then. In object mode every label
+// operand is left to the linker. *label gets the label's index once known.
+// index is the word that takes the address, a MOVW immediate if literal.
+int label_operand(const char *name, int index, int literal, int line_number, int *label) {
+    int relocated = object_mode;
+    int i = table_find(&label_table, name, 0, label_key);
+
+    if (relocated) {
+        relocations = grow(relocations, relocation_count, &relocation_capacity,
+                           sizeof(Relocation));
+        relocations[relocation_count].index = index;
+        relocations[relocation_count].name = copy_string(name);
+        relocation_count++;
     }
+    if (i >= 0) {
+        *label = i;
+        if (relocated) return 0;
+        if (!literal && !label_fits(name, labels[i].address, line_number)) return 0;
+        return labels[i].address;
+    }
+
+    fixups = grow(fixups, fixup_count, &fixup_capacity, sizeof(Fixup));
+    fixups[fixup_count].index = index;
+    fixups[fixup_count].line_number = line_number;
+    fixups[fixup_count].relocated = relocated;
+    fixups[fixup_count].name = copy_string(name);
+    fixup_count++;
+    return 0;
+}
+
+// Helper: Append one word to the program
+void emit(word_t code, int line_number, const char *original, int label, int literal) {
+    instructions = grow(instructions, instruction_count, &instruction_capacity,
+                        sizeof(Instruction));
+    instructions[instruction_count].code = code;
+    instructions[instruction_count].line_number = line_number;
+    instructions[instruction_count].original = copy_string(original);
+    instructions[instruction_count].label = label;
+    instructions[instruction_count].literal = literal;
+    instruction_count++;
 }
 
 // Helper: Encode instruction
@@ -109,13 +294,13 @@ void clean_line(char *line) {
     // Remove comments (semicolon to end of line)
     char *comment = strchr(line, ';');
     if (comment) *comment = '\0';
-    
+
     // Trim trailing whitespace
     int len = strlen(line);
     while (len > 0 && isspace(line[len - 1])) {
         line[--len] = '\0';
     }
-    
+
     // Trim leading whitespace
     char *start = line;
     while (*start && isspace(*start)) start++;
@@ -124,138 +309,712 @@ void clean_line(char *line) {
     }
 }
 
-// First pass: Collect labels
-void first_pass(FILE *fp) {
-    char line[MAX_LINE_LENGTH];
-    int address = 0;
-    int line_number = 0;
-    
-    while (fgets(line, sizeof(line), fp)) {
-        line_number++;
-        clean_line(line);
-        
-        if (strlen(line) == 0) continue;
-        
-        // Check for label (ends with colon)
-        if (strchr(line, ':')) {
-            char label[64];
-            sscanf(line, "%[^:]:", label);
-            add_label(label, address);
-            
-            // Check if there's an instruction on the same line
-            char *after_label = strchr(line, ':') + 1;
-            clean_line(after_label);
-            if (strlen(after_label) > 0) {
-                address++;
-            }
-        } else {
-            // Regular instruction
-            address++;
+// Helper: Handle a directive line
+//   .global name[, name...]   export labels from a relocatable object
+//   .org address              pad with NOPs up to address
+void directive(char *line, int line_number) {
+    char name[16];
+    char *args = line;
+
+    while (*args && !isspace(*args)) args++;
+    int len = (int)(args - line);
+    if (len >= (int)sizeof(name)) len = sizeof(name) - 1;
+    memcpy(name, line, len);
+    name[len] = '\0';
+
+    if (strcasecmp(name, ".org") == 0) {
+        int address = atoi(args);
+        if (object_mode) {
+            fprintf(stderr, "Error on line %d: .org in a relocatable object\n", line_number);
+            error_count++;
+        } else if (address < instruction_count) {
+            fprintf(stderr, "Error on line %d: .org %d is behind the current address %d\n",
+                    line_number, address, instruction_count);
+            error_count++;
+        }
+        while (!object_mode && instruction_count < address) {
+            emit(encode_instruction(0x0, 0, 0, 0), line_number, "        ; (.org padding)\n",
+                 -1, 0);
         }
+        org_used = 1;
+        return;
+    }
+    if (strcasecmp(name, ".global") != 0) {
+        fprintf(stderr, "Error on line %d: Unknown directive '%s'\n", line_number, name);
+        error_count++;
+        return;
+    }
+    for (char *token = strtok(args, ", \t"); token; token = strtok(NULL, ", \t")) {
+        exports = grow(exports, export_count, &export_capacity, sizeof(char *));
+        exports[export_count++] = copy_string(token);
     }
-    
-    rewind(fp);
 }
 
-// Second pass: Generate machine code
-void second_pass(FILE *fp) {
+/* ---------------- Assembly ---------------- */
+
+// Single pass: define labels, generate machine code and record forward
+// references for resolve_fixups
+void assemble(FILE *fp) {
     char line[MAX_LINE_LENGTH];
+    char original[MAX_LINE_LENGTH];
     int line_number = 0;
-    
+
     while (fgets(line, sizeof(line), fp)) {
         line_number++;
-        strcpy(instructions[instruction_count].original, line);
-        instructions[instruction_count].line_number = line_number;
+        strcpy(original, line);
         clean_line(line);
-        
+
         if (strlen(line) == 0) continue;
-        
-        // Skip labels, but check for instruction after label
-        if (strchr(line, ':')) {
-            char *after_label = strchr(line, ':') + 1;
+
+        if (line[0] == '.') {
+            directive(line, line_number);
+            continue;
+        }
+
+        // Define the label, then check for an instruction after it
+        char *colon = strchr(line, ':');
+        if (colon) {
+            *colon = '\0';
+            clean_line(line);
+            add_label(line, instruction_count, line_number);
+
+            char *after_label = colon + 1;
             clean_line(after_label);
             if (strlen(after_label) == 0) continue;
-            strcpy(line, after_label);
+            memmove(line, after_label, strlen(after_label) + 1);
         }
-        
+
         // Parse instruction
         char mnemonic[16];
         char operands[MAX_LINE_LENGTH];
-        
+
         // Split mnemonic and operands
-        int items = sscanf(line, "%s %[^\n]", mnemonic, operands);
-        
-        int op = get_opcode(mnemonic);
+        int items = sscanf(line, "%15s %[^\n]", mnemonic, operands);
+
+        int variant;
+        int op = get_opcode(mnemonic, &variant);
         if (op == -1) {
-            fprintf(stderr, "Error on line %d: Unknown instruction '%s'\n", 
+            fprintf(stderr, "Error on line %d: Unknown instruction '%s'\n",
                     line_number, mnemonic);
+            error_count++;
             continue;
         }
-        
-        int r1 = 0, r2 = 0, imm = 0;
-        
+
+        int r1 = 0, r2 = variant, imm = 0, label = -1;
+        int wide = 0;   // MOVW: imm is the 16-bit word that follows
+
         if (items == 2) {
             // Parse operands
             char *token = strtok(operands, ",");
-            char tokens[3][64];
+            char tokens[3][MAX_LINE_LENGTH] = { "", "", "" };
             int token_count = 0;
-            
+
             while (token && token_count < 3) {
                 // Trim whitespace
                 while (*token && isspace(*token)) token++;
                 char *end = token + strlen(token) - 1;
                 while (end > token && isspace(*end)) *end-- = '\0';
-                
+
                 strcpy(tokens[token_count++], token);
                 token = strtok(NULL, ",");
             }
-            
+
             // Decode based on instruction type
             if (op == 0x0 || op == 0xB || op == 0xC) {
                 // NOP, RET, HALT - no operands
-            } else if (op == 0x1) {
-                // MOV R1, IMM
+            } else if ((op == 0x1 || op == 0x2 || op == 0x3) && parse_register(tokens[1]) >= 0) {
+                // MOV/ADD/SUB/CMP R1, R2: register form, source in the immediate
+                r1 = parse_register(tokens[0]);
+                r2 |= 1;
+                imm = parse_register(tokens[1]);
+            } else if (op == 0x1 || op == 0xF) {
+                // MOV/MOVW R1, IMM; a number that does not fit in 6 bits
+                // takes the two-word MOVW. A label stays 6 bits unless
+                // MOVW is written.
                 r1 = parse_register(tokens[0]);
                 int is_label;
                 imm = parse_immediate(tokens[1], &is_label);
                 if (is_label) {
-                    imm = find_label(tokens[1]);
-                    if (imm == -1) {
-                        fprintf(stderr, "Error on line %d: Undefined label '%s'\n",
-                                line_number, tokens[1]);
+                    // MOVW takes the address in the word after it
+                    imm = label_operand(tokens[1], instruction_count + (op == 0xF),
+                                        op == 0xF, line_number, &label);
+                } else if (imm < 0 || imm > 63) {
+                    if (imm < -32768 || imm > 65535) {
+                        fprintf(stderr, "Error on line %d: Constant %d does not fit "
+                                "in 16 bits\n", line_number, imm);
+                        error_count++;
                     }
+                    op = 0xF;
                 }
+                wide = op == 0xF;
+            } else if (op == 0xD || op == 0xE) {
+                // LOAD/STORE R1, R2
+                r1 = parse_register(tokens[0]);
+                r2 = parse_register(tokens[1]);
             } else if (op == 0x2 || op == 0x3) {
-                // ADD/SUB R1, IMM
+                // ADD/SUB/CMP R1, IMM
                 r1 = parse_register(tokens[0]);
                 int is_label;
                 imm = parse_immediate(tokens[1], &is_label);
                 if (is_label) {
-                    imm = find_label(tokens[1]);
+                    imm = label_operand(tokens[1], instruction_count, 0, line_number, &label);
+                } else if (imm < 0 || imm > 63) {
+                    fprintf(stderr, "Error on line %d: Constant %d does not fit in 6 bits; "
+                            "load it with MOVW Rt, %d and use %s R%d, Rt\n", line_number, imm,
+                            imm, variant == 2 ? "CMP" : op == 0x2 ? "ADD" : "SUB", r1);
+                    error_count++;
                 }
             } else if (op == 0x4 || op == 0x5 || op == 0x6 || op == 0x7) {
                 // AND/OR/MUL/DIV R1, R2
                 r1 = parse_register(tokens[0]);
                 r2 = parse_register(tokens[1]);
             } else if (op == 0x8 || op == 0x9 || op == 0xA) {
-                // JMP/JZ/CALL IMM (or label)
+                // JMP/Jcc/CALL IMM (or label); DJNZ R1, IMM
+                int target = 0;
+                if (op == 0x9 && variant == COND_DJNZ) {
+                    r1 = parse_register(tokens[0]);
+                    target = 1;
+                }
                 int is_label;
-                imm = parse_immediate(tokens[0], &is_label);
-                if (is_label) {
-                    imm = find_label(tokens[0]);
-                    if (imm == -1) {
-                        fprintf(stderr, "Error on line %d: Undefined label '%s'\n",
-                                line_number, tokens[0]);
-                    }
+                imm = parse_immediate(tokens[target], &is_label);
+                if (!is_label && object_mode) {
+                    fprintf(stderr, "Error on line %d: Jump to a fixed address in a "
+                            "relocatable object; use a label\n", line_number);
+                    error_count++;
+                } else if (is_label) {
+                    imm = label_operand(tokens[target], instruction_count, 0, line_number, &label);
+                }
+            }
+        }
+
+        if (wide) {
+            emit(encode_instruction(op, r1, 0, 0), line_number, original, -1, 0);
+            emit((word_t)imm, line_number, "        ; (immediate of the MOVW above)\n",
+                 label, 1);
+        } else {
+            emit(encode_instruction(op, r1, r2, imm), line_number, original, label, 0);
+        }
+    }
+}
+
+// Backpatch the immediate field of every forward reference
+void resolve_fixups(void) {
+    for (int i = 0; i < fixup_count; i++) {
+        int label = table_find(&label_table, fixups[i].name, 0, label_key);
+        if (label >= 0) instructions[fixups[i].index].label = label;
+        if (fixups[i].relocated) continue;    // an import if undefined
+
+        int address = label >= 0 ? labels[label].address : -1;
+        if (address == -1) {
+            fprintf(stderr, "Error on line %d: Undefined label '%s'\n",
+                    fixups[i].line_number, fixups[i].name);
+            error_count++;
+            continue;
+        }
+        Instruction *in = &instructions[fixups[i].index];
+        if (!in->literal && !label_fits(fixups[i].name, address, fixups[i].line_number)) continue;
+        in->code |= (word_t)address;
+    }
+}
+
+// Flag the labels named in .global directives
+void mark_exports(void) {
+    for (int e = 0; e < export_count; e++) {
+        int i = table_find(&label_table, exports[e], 0, label_key);
+        if (i < 0) {
+            fprintf(stderr, "Error: Exported label '%s' is not defined\n", exports[e]);
+            error_count++;
+        } else {
+            labels[i].global = 1;
+        }
+    }
+}
+
+/* ---------------- Peephole optimizer (-O) ---------------- */
+
+// Works on the assembled instruction list. Removing an instruction moves
+// its labels to the next instruction that is kept, and immediates that
+// came from labels are re-encoded from the labels' new addresses. The
+// immediate word of a MOVW is not an instruction: the passes skip it and
+// it goes wherever its MOVW goes. Programs that LOAD or STORE their own
+// code are assumed not to exist.
+
+enum {
+    OP_NOP, OP_MOV, OP_ADD, OP_SUB, OP_AND, OP_OR, OP_MUL, OP_DIV,
+    OP_JMP, OP_JZ, OP_CALL, OP_RET, OP_HALT, OP_LOAD, OP_STORE, OP_MOVW
+};
+
+#define OP_OF(w)  (((w) >> 12) & 0xF)
+#define R1_OF(w)  (((w) >> 9) & 0x7)
+#define R2_OF(w)  (((w) >> 6) & 0x7)
+#define IMM_OF(w) ((w) & 0x3F)
+
+// MOV/ADD/SUB with R2 bit 0 set take the register in the low bits of IMM;
+// SUB with R2 bit 1 set is CMP, which only writes the flags
+#define REG_FORM(w) (OP_OF(w) >= OP_MOV && OP_OF(w) <= OP_SUB && (R2_OF(w) & 1))
+#define IS_CMP(w)   (OP_OF(w) == OP_SUB && (R2_OF(w) & 2))
+#define IS_DJNZ(w)  (OP_OF(w) == OP_JZ && R2_OF(w) == COND_DJNZ)
+#define SRC_OF(w)   ((w) & 0x7)
+
+// Liveness sets: bit r for register r, plus one bit for the ALU flags,
+// which every ALU instruction overwrites together
+#define LIVE_FLAGS (1 << 8)
+#define LIVE_ALL   0x1FF
+
+enum { PASS_UNREACHABLE, PASS_THREAD, PASS_FOLD, PASS_DEAD, PASS_COUNT };
+
+const char *PASS_NAMES[PASS_COUNT] = {
+    "unreachable code", "jump threading", "constant folding", "dead code"
+};
+
+int optimize = 0;
+int pass_saved[PASS_COUNT];
+int jumps_threaded = 0, constants_folded = 0;
+
+int is_branch(int op) {
+    return op == OP_JMP || op == OP_JZ || op == OP_CALL;
+}
+
+// Instruction a JMP/JZ/CALL goes to (instruction_count past the end),
+// -1 if it leaves the module
+int branch_target(int i) {
+    int label = instructions[i].label;
+    return label >= 0 ? labels[label].address : -1;
+}
+
+// Successors of instruction i in the control flow graph; returns the count
+int successors(int i, int succ[2]) {
+    int op = OP_OF(instructions[i].code);
+
+    switch (op) {
+    case OP_JMP:  succ[0] = branch_target(i); return 1;
+    case OP_JZ:
+    case OP_CALL: succ[0] = branch_target(i); succ[1] = i + 1; return 2;
+    case OP_RET:
+    case OP_HALT: return 0;
+    case OP_MOVW: succ[0] = i + 2; return 1;
+    default:      succ[0] = i + 1; return 1;
+    }
+}
+
+void uses_defs(word_t w, int *use, int *def) {
+    int r1 = 1 << R1_OF(w), r2 = 1 << R2_OF(w);
+
+    *use = *def = 0;
+    if (IS_CMP(w)) {
+        *use = r1 | (REG_FORM(w) ? 1 << SRC_OF(w) : 0);
+        *def = LIVE_FLAGS;
+        return;
+    }
+    if (IS_DJNZ(w)) {
+        *use = r1;
+        *def = r1 | LIVE_FLAGS;
+        return;
+    }
+    if (REG_FORM(w)) {
+        *use = 1 << SRC_OF(w);
+        if (OP_OF(w) == OP_MOV) *def = r1;
+        else { *use |= r1; *def = r1 | LIVE_FLAGS; }
+        return;
+    }
+    switch (OP_OF(w)) {
+    case OP_NOP: case OP_JMP: break;
+    case OP_MOV: case OP_MOVW: *def = r1; break;
+    case OP_LOAD: *use = r2; *def = r1; break;
+    case OP_STORE: *use = r1 | r2; break;
+    case OP_ADD: case OP_SUB: *use = r1; *def = r1 | LIVE_FLAGS; break;
+    case OP_AND: case OP_OR: case OP_MUL:
+        *use = r1 | r2; *def = r1 | LIVE_FLAGS; break;
+    case OP_DIV: *use = LIVE_ALL; *def = r1 | LIVE_FLAGS; break;   // a fault shows every register
+    case OP_JZ: *use = LIVE_FLAGS; break;   // every condition but DJNZ reads the flags
+    default: *use = LIVE_ALL; break;   // CALL, RET, HALT: anything may be read or shown
+    }
+}
+
+// live_out[i]: registers and flags that may be read after instruction i.
+// Everything is live wherever control leaves the module or stops.
+void compute_liveness(uint16_t *live_out) {
+    int n = instruction_count, changed = 1;
+    uint16_t *live_in = calloc(n + 1, sizeof(uint16_t));
+
+    live_in[n] = LIVE_ALL;
+    while (changed) {
+        changed = 0;
+        for (int i = n - 1; i >= 0; i--) {
+            if (instructions[i].literal) continue;
+            int succ[2], count = successors(i, succ), use, def;
+            int out = count ? 0 : LIVE_ALL;
+            for (int k = 0; k < count; k++) out |= succ[k] < 0 ? LIVE_ALL : live_in[succ[k]];
+            uses_defs(instructions[i].code, &use, &def);
+            uint16_t in = (uint16_t)(use | (out & ~def));
+            live_out[i] = (uint16_t)out;
+            if (in != live_in[i]) {
+                live_in[i] = in;
+                changed = 1;
+            }
+        }
+    }
+    free(live_in);
+}
+
+// Replace instruction i with MOV r, value
+void rewrite_mov(int i, int r, int value, const char *why) {
+    char text[MAX_LINE_LENGTH];
+
+    snprintf(text, sizeof(text), "    MOV R%d, %d        ; %s (line %d)\n", r, value, why,
+             instructions[i].line_number);
+    free(instructions[i].original);
+    instructions[i].original = copy_string(text);
+    instructions[i].code = encode_instruction(OP_MOV, r, 0, value);
+    instructions[i].label = -1;
+}
+
+// Drop the instructions marked dead; returns how many words went
+int compact(const char *dead) {
+    int n = instruction_count, kept = 0, drop = 0;
+    int *map = malloc((n + 1) * sizeof(int));
+
+    for (int i = 0; i < n; i++) {
+        map[i] = kept;
+        drop = instructions[i].literal ? drop : dead[i];
+        if (drop) free(instructions[i].original);
+        else instructions[kept++] = instructions[i];
+    }
+    map[n] = kept;
+
+    for (int i = 0; i < label_count; i++) labels[i].address = map[labels[i].address];
+    int r = 0;
+    for (int i = 0; i < relocation_count; i++) {
+        int index = relocations[i].index;
+        if (map[index] == map[index + 1]) continue;   // dropped
+        relocations[r] = relocations[i];
+        relocations[r++].index = map[relocations[i].index];
+    }
+    relocation_count = r;
+    instruction_count = kept;
+    free(map);
+    return n - kept;
+}
+
+// Remove what cannot be reached from address 0, an exported label or
+// a label whose address is taken by MOV/ADD/SUB
+void pass_unreachable(char *dead) {
+    int n = instruction_count, top = 0;
+    int *stack = malloc((3 * n + label_count + 1) * sizeof(int));
+    char *seen = calloc(n + 1, 1);
+
+    stack[top++] = 0;
+    for (int i = 0; i < label_count; i++) {
+        if (labels[i].global) stack[top++] = labels[i].address;
+    }
+    for (int i = 0; i < n; i++) {
+        int label = instructions[i].label;
+        if (label >= 0 && (instructions[i].literal || !is_branch(OP_OF(instructions[i].code)))) {
+            stack[top++] = labels[label].address;
+        }
+    }
+
+    while (top) {
+        int i = stack[--top], succ[2];
+        if (i < 0 || i >= n || seen[i]) continue;
+        seen[i] = 1;
+        int count = successors(i, succ);
+        for (int k = 0; k < count; k++) stack[top++] = succ[k];
+    }
+    for (int i = 0; i < n; i++) dead[i] = !seen[i];
+    free(stack);
+    free(seen);
+}
+
+// Send jumps to a JMP straight to its final target, turn a JMP to HALT or
+// RET into that instruction and drop jumps to the next instruction
+void pass_thread(char *dead) {
+    int n = instruction_count;
+
+    for (int i = 0; i < n; i++) {
+        int op = OP_OF(instructions[i].code);
+        int label = instructions[i].label, steps = 0;
+        if (instructions[i].literal || !is_branch(op) || label < 0) continue;
+
+        int t = labels[label].address;
+        while (t < n && OP_OF(instructions[t].code) == OP_JMP && instructions[t].label >= 0 &&
+               steps++ < n) {
+            label = instructions[t].label;
+            t = labels[label].address;
+        }
+        if (steps > n) continue;   // a cycle of jumps; leave it alone
+        if (label != instructions[i].label) {
+            instructions[i].label = label;
+            jumps_threaded++;
+        }
+
+        if (op == OP_JMP && t < n &&
+            (OP_OF(instructions[t].code) == OP_HALT || OP_OF(instructions[t].code) == OP_RET)) {
+            free(instructions[i].original);
+            instructions[i].original = copy_string(instructions[t].original);
+            instructions[i].code = instructions[t].code;
+            instructions[i].label = -1;
+            jumps_threaded++;
+        } else if ((op == OP_JMP || op == OP_JZ) && !IS_DJNZ(instructions[i].code) &&
+                   t == i + 1) {
+            dead[i] = 1;
+        }
+    }
+}
+
+// Track constant registers through each basic block: fold ALU operations
+// on constants into MOV when the flags they set are never read, and drop
+// reloads of a value a register already holds and no-op arithmetic
+void pass_fold(char *dead, const uint16_t *live_out) {
+    int n = instruction_count, valid = 0;
+    word_t value[8] = { 0 };
+    char *leader = calloc(n + 1, 1);
+
+    leader[0] = 1;
+    for (int i = 0; i < label_count; i++) leader[labels[i].address] = 1;
+    for (int i = 0; i < n; i++) {
+        int op = OP_OF(instructions[i].code);
+        if (instructions[i].literal) continue;
+        if (is_branch(op) || op == OP_RET || op == OP_HALT) leader[i + 1] = 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (instructions[i].literal) continue;
+        word_t w = instructions[i].code;
+        int op = OP_OF(w), r1 = R1_OF(w), r2 = R2_OF(w), imm = IMM_OF(w);
+        int symbolic = instructions[i].label >= 0;   // address that may still move
+
+        if (op == OP_MOVW) {
+            op = OP_MOV;
+            imm = instructions[i + 1].code;
+            symbolic = instructions[i + 1].label >= 0;
+        }
+        int flags_dead = !(live_out[i] & LIVE_FLAGS);
+        int known1 = valid >> r1 & 1, known2 = valid >> r2 & 1;
+
+        if (leader[i]) valid = known1 = known2 = 0;
+
+        if (IS_CMP(w)) continue;   // registers unchanged
+        if (IS_DJNZ(w)) {
+            valid &= ~(1 << r1);
+            continue;
+        }
+        if (REG_FORM(w)) {
+            int rs = SRC_OF(w), known_src = valid >> rs & 1;
+            if (op == OP_MOV && (rs == r1 || (known1 && known_src && value[r1] == value[rs]))) {
+                dead[i] = 1;
+            } else if (op == OP_MOV && known_src) {
+                value[r1] = value[rs];
+                valid |= 1 << r1;
+            } else if (op != OP_MOV && known1 && known_src) {
+                value[r1] = (word_t)(op == OP_ADD ? value[r1] + value[rs] : value[r1] - value[rs]);
+                if (flags_dead && value[r1] < 64) {
+                    rewrite_mov(i, r1, value[r1], "folded");
+                    constants_folded++;
                 }
+            } else {
+                valid &= ~(1 << r1);
             }
+            continue;
         }
-        
-        instructions[instruction_count].code = encode_instruction(op, r1, r2, imm);
-        instruction_count++;
+
+        switch (op) {
+        case OP_MOV:
+            if (symbolic) {
+                valid &= ~(1 << r1);
+            } else if (known1 && value[r1] == imm) {
+                dead[i] = 1;
+            } else {
+                value[r1] = (word_t)imm;
+                valid |= 1 << r1;
+            }
+            break;
+        case OP_ADD:
+        case OP_SUB:
+            if (symbolic) {
+                valid &= ~(1 << r1);
+            } else if (known1) {
+                value[r1] = (word_t)(op == OP_ADD ? value[r1] + imm : value[r1] - imm);
+                if (flags_dead && value[r1] < 64) {
+                    rewrite_mov(i, r1, value[r1], "folded");
+                    constants_folded++;
+                }
+            } else if (imm == 0 && flags_dead) {
+                dead[i] = 1;
+            }
+            break;
+        case OP_AND:
+        case OP_OR:
+        case OP_MUL:
+        case OP_DIV:
+            if (known1 && known2 && !(op == OP_DIV && value[r2] == 0)) {
+                word_t a = value[r1], b = value[r2];
+                value[r1] = (word_t)(op == OP_AND ? a & b : op == OP_OR ? a | b :
+                                     op == OP_MUL ? a * b : a / b);
+                if (flags_dead && value[r1] < 64) {
+                    rewrite_mov(i, r1, value[r1], "folded");
+                    constants_folded++;
+                }
+            } else if (flags_dead && (((op == OP_AND || op == OP_OR) && r1 == r2) ||
+                                      ((op == OP_MUL || op == OP_DIV) && known2 &&
+                                       value[r2] == 1))) {
+                dead[i] = 1;
+            } else {
+                valid &= ~(1 << r1);
+            }
+            break;
+        case OP_LOAD:
+            valid &= ~(1 << r1);
+            break;
+        default:
+            break;
+        }
+    }
+    free(leader);
+}
+
+// Remove NOPs and instructions whose results are all overwritten unread
+void pass_dead(char *dead, const uint16_t *live_out) {
+    for (int i = 0; i < instruction_count; i++) {
+        word_t w = instructions[i].code;
+        int op = OP_OF(w), use, def;
+        if (instructions[i].literal) continue;
+        if (op > OP_MUL && op != OP_LOAD && op != OP_MOVW) continue;   // DIV can fault; jumps and STORE have effects
+        uses_defs(w, &use, &def);
+        if (!(def & live_out[i])) dead[i] = 1;
     }
 }
 
+// Whether the program is in a shape the passes can reason about
+int optimizer_applicable(void) {
+    if (org_used) {
+        fprintf(stderr, "  -O skipped: .org fixes the addresses of the code\n");
+        return 0;
+    }
+    for (int i = 0; i < instruction_count; i++) {
+        word_t w = instructions[i].code;
+        int op = OP_OF(w), label = instructions[i].label;
+
+        if (instructions[i].literal) continue;   // takes any address
+        if (label >= 0 && !object_mode && labels[label].address >= 64) {
+            fprintf(stderr, "  -O skipped: label '%s' is beyond address 63\n", labels[label].name);
+            return 0;
+        }
+        if (is_branch(op) && label < 0 && !object_mode && IMM_OF(w) > instruction_count) {
+            fprintf(stderr, "  -O skipped: jump outside the program on line %d\n",
+                    instructions[i].line_number);
+            return 0;
+        }
+        if (is_branch(op) && label < 0 && !object_mode && IMM_OF(w) < instruction_count &&
+            instructions[IMM_OF(w)].literal) {
+            fprintf(stderr, "  -O skipped: jump into a MOVW on line %d\n",
+                    instructions[i].line_number);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void optimize_program(void) {
+    int before = instruction_count, rounds = 0;
+
+    if (!optimizer_applicable()) return;
+
+    // Numeric jump targets become unnamed labels so they move with the code
+    for (int i = 0; i < instruction_count; i++) {
+        word_t w = instructions[i].code;
+        if (instructions[i].literal || !is_branch(OP_OF(w)) || instructions[i].label >= 0 ||
+            object_mode) continue;
+        labels = grow(labels, label_count, &label_capacity, sizeof(Label));
+        labels[label_count].name = copy_string(".L");
+        labels[label_count].address = IMM_OF(w);
+        labels[label_count].global = 0;
+        instructions[i].label = label_count++;
+    }
+
+    for (int changed = 1; changed && rounds < 100; rounds++) {
+        int work_before = jumps_threaded + constants_folded;
+        changed = 0;
+        for (int p = 0; p < PASS_COUNT; p++) {
+            char *dead = calloc(instruction_count + 1, 1);
+            uint16_t *live_out = calloc(instruction_count + 1, sizeof(uint16_t));
+
+            if (p == PASS_FOLD || p == PASS_DEAD) compute_liveness(live_out);
+            switch (p) {
+            case PASS_UNREACHABLE: pass_unreachable(dead); break;
+            case PASS_THREAD:      pass_thread(dead); break;
+            case PASS_FOLD:        pass_fold(dead, live_out); break;
+            case PASS_DEAD:        pass_dead(dead, live_out); break;
+            }
+            int saved = compact(dead);
+            pass_saved[p] += saved;
+            changed |= saved != 0;
+            free(dead);
+            free(live_out);
+        }
+        changed |= jumps_threaded + constants_folded != work_before;
+    }
+
+    // Label immediates take the labels' new addresses; the linker fills
+    // in relocated ones
+    for (int i = 0; i < instruction_count; i++) {
+        int label = instructions[i].label;
+        if (label < 0 || object_mode) continue;
+        if (instructions[i].literal) {
+            instructions[i].code = (word_t)labels[label].address;
+            continue;
+        }
+        instructions[i].code = (word_t)((instructions[i].code & ~0x3F) |
+                                        (labels[label].address & 0x3F));
+    }
+
+    // Relocations follow threaded jumps and go with jumps replaced by HALT/RET
+    int kept = 0;
+    for (int i = 0; i < relocation_count; i++) {
+        Instruction *in = &instructions[relocations[i].index];
+        int op = OP_OF(in->code);
+        if (!in->literal && !is_branch(op) && op != OP_MOV && op != OP_ADD && op != OP_SUB) continue;
+        if (in->label >= 0) relocations[i].name = labels[in->label].name;
+        relocations[kept++] = relocations[i];
+    }
+    relocation_count = kept;
+
+    printf("  Optimizer (-O), %d round(s):\n", rounds);
+    for (int p = 0; p < PASS_COUNT; p++) {
+        printf("    %-18s %4d saved", PASS_NAMES[p], pass_saved[p]);
+        if (p == PASS_THREAD) printf(", %d jump(s) retargeted", jumps_threaded);
+        if (p == PASS_FOLD) printf(", %d instruction(s) folded", constants_folded);
+        printf("\n");
+    }
+    printf("    %d -> %d instructions (%d saved)\n", before, instruction_count,
+           before - instruction_count);
+}
+
+// Output a relocatable object (see linker.c for the format)
+void output_object(const char *output_file) {
+    FILE *fp = fopen(output_file, "w");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open output file '%s'\n", output_file);
+        return;
+    }
+
+    fprintf(fp, "CMPE220-OBJ 1\n");
+    for (int i = 0; i < instruction_count; i++) {
+        fprintf(fp, "word 0x%04X  ; [%d] %s", instructions[i].code, i, instructions[i].original);
+        if (!strchr(instructions[i].original, '\n')) fputc('\n', fp);
+    }
+    for (int i = 0; i < label_count; i++) {
+        fprintf(fp, "label %s %d %s\n", labels[i].name, labels[i].address,
+                labels[i].global ? "global" : "local");
+    }
+    for (int i = 0; i < relocation_count; i++) {
+        fprintf(fp, "reloc %d %s\n", relocations[i].index, relocations[i].name);
+    }
+    fprintf(fp, "end\n");
+
+    fclose(fp);
+}
+
 // Output machine code
 void output_machine_code(const char *output_file) {
     FILE *fp = fopen(output_file, "w");
@@ -263,82 +1022,127 @@ void output_machine_code(const char *output_file) {
         fprintf(stderr, "Error: Cannot open output file '%s'\n", output_file);
         return;
     }
-    
+
     fprintf(fp, "// Machine code generated by CMPE220 Assembler\n");
     fprintf(fp, "// Total instructions: %d\n\n", instruction_count);
     fprintf(fp, "word_t program[] = {\n");
-    
+
     for (int i = 0; i < instruction_count; i++) {
         fprintf(fp, "    0x%04X", instructions[i].code);
         if (i < instruction_count - 1) fprintf(fp, ",");
         fprintf(fp, "  // [%d] %s", i, instructions[i].original);
     }
-    
+
     fprintf(fp, "};\n\n");
     fprintf(fp, "int program_size = %d;\n", instruction_count);
-    
+
     fclose(fp);
 }
 
-// Output binary file
+// Output binary image (image.h), loaded at address 0 and entered there
 void output_binary(const char *output_file) {
     FILE *fp = fopen(output_file, "wb");
-    if (!fp) {
+    word_t *words = malloc((instruction_count ? instruction_count : 1) * sizeof(word_t));
+    if (!fp || !words) {
         fprintf(stderr, "Error: Cannot open output file '%s'\n", output_file);
+        if (fp) fclose(fp);
+        free(words);
         return;
     }
-    
+
     for (int i = 0; i < instruction_count; i++) {
-        fwrite(&instructions[i].code, sizeof(word_t), 1, fp);
+        words[i] = instructions[i].code;
     }
-    
+    if (!image_write(fp, words, instruction_count, 0, 0)) {
+        fprintf(stderr, "Error: Cannot write output file '%s'\n", output_file);
+    }
+
+    free(words);
     fclose(fp);
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-c") == 0) object_mode = 1;
+        else if (strcmp(argv[arg], "-O") == 0) optimize = 1;
+        else break;
+    }
+    if (arg >= argc) {
         printf("CMPE220 Assembler\n");
-        printf("Usage: %s <input.asm> [output.h]\n", argv[0]);
+        printf("Usage: %s [-c] [-O] <input.asm> [output]\n", argv[0]);
         printf("  Assembles .asm file into machine code\n");
         printf("  Default output: program.h (C header file)\n");
+        printf("  -c  Write a relocatable object for the linker instead\n");
+        printf("      (default output: input name with .o)\n");
+        printf("  -O  Optimize: drop unreachable, dead and redundant instructions,\n");
+        printf("      fold constants and thread jumps; prints a per-pass report\n");
         return 1;
     }
-    
-    const char *input_file = argv[1];
-    const char *output_file = argc > 2 ? argv[2] : "program.h";
-    
+
+    const char *input_file = argv[arg];
+    char object_file[256];
+    const char *output_file = arg + 1 < argc ? argv[arg + 1] : "program.h";
+    if (object_mode && arg + 1 >= argc) {
+        snprintf(object_file, sizeof(object_file) - 2, "%s", input_file);
+        char *dot = strrchr(object_file, '.');
+        if (dot && !strchr(dot, '/')) strcpy(dot, ".o");
+        else strcat(object_file, ".o");
+        output_file = object_file;
+    }
+
     FILE *fp = fopen(input_file, "r");
     if (!fp) {
         fprintf(stderr, "Error: Cannot open input file '%s'\n", input_file);
         return 1;
     }
-    
+
     printf("CMPE220 Assembler - Assembling '%s'...\n", input_file);
-    
-    // First pass: collect labels
-    first_pass(fp);
+
+    for (int i = 0; i < (int)(sizeof(opcodes) / sizeof(opcodes[0])); i++) {
+        table_insert(&opcode_table, opcodes[i].mnemonic, i, 1, opcode_key);
+    }
+
+    // One pass over the source, then patch forward references
+    assemble(fp);
+    resolve_fixups();
+    mark_exports();
     printf("  Found %d labels\n", label_count);
-    
-    // Second pass: generate code
-    second_pass(fp);
     printf("  Generated %d instructions\n", instruction_count);
-    
+    if (optimize && !error_count) optimize_program();
+
     fclose(fp);
-    
+
+    if (object_mode) {
+        output_object(output_file);
+        printf("  %d relocations, %d exported labels\n", relocation_count, export_count);
+        printf("  Object written to '%s'\n", output_file);
+        if (error_count) {
+            fprintf(stderr, "Assembly finished with %d error(s)\n", error_count);
+            return 1;
+        }
+        printf("Assembly complete!\n");
+        return 0;
+    }
+
     // Output machine code
     output_machine_code(output_file);
     printf("  Machine code written to '%s'\n", output_file);
-    
+
     // Also output binary
     char binary_file[256];
-    strcpy(binary_file, output_file);
+    snprintf(binary_file, sizeof(binary_file) - 4, "%s", output_file);
     char *dot = strrchr(binary_file, '.');
     if (dot) strcpy(dot, ".bin");
     else strcat(binary_file, ".bin");
-    
+
     output_binary(binary_file);
     printf("  Binary written to '%s'\n", binary_file);
-    
+
+    if (error_count) {
+        fprintf(stderr, "Assembly finished with %d error(s)\n", error_count);
+        return 1;
+    }
     printf("Assembly complete!\n");
     return 0;
 }
@@ -0,0 +1,493 @@
+// batch.c
+// Runs one program image against many initial register/memory setups.
+//
+// Every job gets its own struct CPU; the jobs share nothing, so they are
+// spread over a work-stealing pool with one thread per core. Each worker
+// owns a deque of job indices, pops from its front and, when it runs dry,
+// steals the back half of another worker's deque.
+//
+// With -P n, the first n instructions run once up front and every job is
+// forked from a snapshot of that state (cpu_snapshot/cpu_restore), so a
+// shared setup phase is not repeated per job. Job assignments then apply
+// at the checkpoint.
+//
+// With -s, each worker takes up to LANES jobs at a time and runs them in
+// lockstep as one SIMD group (see lockstep.c); lanes that diverge finish
+// on the scalar core.
+//
+// Usage: batch [-j] [-s] [-t threads] [-n max_instr] [-P prefix] [-m addr:count]
+//              program.bin jobs.txt
+// Build: gcc -std=c11 -O2 -mavx2 batch.c lockstep.c image.c cpu.c -o batch -pthread
+//
+// jobs.txt has one job per line. A line holds assignments applied after
+// the program is loaded: "R3=5" sets a register, "M100=0x20" a memory
+// word. Blank lines and '#' comments are skipped.
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE   // sysconf and clock_gettime under -std=c11
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "image.h"
+#include "lockstep.h"
+
+#define BATCH_DEFAULT_LIMIT 100000000ULL  // instructions before a job is cut off
+
+/* ---------------- Jobs and results ---------------- */
+
+struct Poke {
+    word_t address, value;
+};
+
+struct BatchJob {
+    word_t reg[8];
+    uint8_t reg_set;          // bit r set: reg[r] overrides the loaded value
+    struct Poke *pokes;
+    int poke_count;
+};
+
+struct BatchResult {
+    struct GPR gpr;
+    word_t IP, SP;
+    const char *fault;        // NULL after a clean HALT
+    int hit_limit;            // stopped by -n rather than HALT or a fault
+    uint64_t executed;
+    word_t *region;           // -m snapshot of memory, region_count words
+    char *output;             // captured console text, NULL if none
+    size_t output_len;
+};
+
+struct Batch {
+    struct Image program;     // mapped; unwritten job pages point into it
+    struct BatchJob *jobs;
+    struct BatchResult *results;
+    int job_count;
+    uint64_t limit;
+    struct CPUSnapshot *checkpoint;   // -P: state every job starts from, or NULL
+    uint64_t prefix_done;             // instructions run to reach the checkpoint
+    unsigned region_start, region_count;
+    int use_jit;
+    int use_lockstep;
+    atomic_int unclaimed;     // jobs not yet popped by any worker
+};
+
+/* ---------------- Work-stealing deques ---------------- */
+
+// Job indices [head, tail) still owned by one worker
+struct Deque {
+    pthread_mutex_t lock;
+    int head, tail;
+};
+
+struct Worker {
+    struct Batch *batch;
+    struct Deque *deques;
+    int id, count;
+    pthread_t thread;
+    int jobs_run, jobs_stolen;
+};
+
+// Take up to max jobs from the front; returns how many, starting at *first
+static int deque_pop(struct Batch *b, struct Deque *dq, int max, int *first) {
+    int n = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->head < dq->tail) {
+        n = dq->tail - dq->head < max ? dq->tail - dq->head : max;
+        *first = dq->head;
+        dq->head += n;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    if (n) atomic_fetch_sub(&b->unclaimed, n);
+    return n;
+}
+
+// Move the back half of victim's jobs into own (which is empty)
+static int deque_steal(struct Deque *own, struct Deque *victim) {
+    int first = 0, last = 0;
+
+    pthread_mutex_lock(&victim->lock);
+    int left = victim->tail - victim->head;
+    if (left > 0) {
+        last  = victim->tail;
+        first = last - (left + 1) / 2;
+        victim->tail = first;
+    }
+    pthread_mutex_unlock(&victim->lock);
+    if (first == last) return 0;
+
+    pthread_mutex_lock(&own->lock);
+    own->head = first;
+    own->tail = last;
+    pthread_mutex_unlock(&own->lock);
+    return last - first;
+}
+
+/* ---------------- Running one job ---------------- */
+
+// Reset cpu to the job's initial state
+static void job_load(struct Batch *b, int index, struct CPU *cpu) {
+    struct BatchJob *job = &b->jobs[index];
+    struct JIT *jit = cpu->jit;
+
+    cpu_release(cpu);
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->jit = jit;
+    console_open(&cpu->console, CONSOLE_CAPTURE, NULL, 0);
+
+    if (b->checkpoint) {
+        cpu_restore(cpu, b->checkpoint);
+    } else {
+        const struct Image *img = &b->program;
+        cpu_map_program(cpu, img->words, img->size, img->load, img->entry);
+    }
+    for (int p = 0; p < job->poke_count; p++) {
+        cpu_poke(cpu, job->pokes[p].address, job->pokes[p].value);
+    }
+    for (int r = 0; r < 8; r++) {
+        if (job->reg_set & (1u << r)) cpu->gpr.reg[r] = job->reg[r];
+    }
+}
+
+// Run cpu (already executed instructions in) to the end and record the result
+static void job_finish(struct Batch *b, int index, struct CPU *cpu, uint64_t executed) {
+    struct BatchResult *res = &b->results[index];
+
+    // Runaway jobs are cut off after b->limit instructions
+    if (executed < b->limit) {
+        executed += cpu_run(cpu, b->limit - executed).cycles;
+    }
+    console_flush(&cpu->console);
+
+    res->gpr = cpu->gpr;
+    res->IP = cpu->cu.IP;
+    res->SP = cpu->spr.SP;
+    res->fault = cpu->fault;
+    res->hit_limit = !cpu_is_halted(cpu);
+    res->executed = executed;
+    if (b->region_count) {
+        res->region = malloc(b->region_count * sizeof(word_t));
+        if (res->region) {
+            for (unsigned i = 0; i < b->region_count; i++) {
+                res->region[i] = cpu_peek(cpu, (word_t)(b->region_start + i));
+            }
+        }
+    }
+    // Hand the captured text over to the result
+    res->output = cpu->console.capture;
+    res->output_len = cpu->console.capture_len;
+    cpu->console.capture = NULL;
+    console_close(&cpu->console);
+}
+
+static void run_job(struct Batch *b, int index, struct CPU *cpu) {
+    job_load(b, index, cpu);
+    job_finish(b, index, cpu, b->prefix_done);
+}
+
+// Lanes leaving a lockstep group finish on the scalar core
+struct GroupCtx {
+    struct Batch *batch;
+    int first;
+};
+
+static void group_eject(void *ctx, int lane, struct CPU *cpu, uint64_t executed) {
+    struct GroupCtx *gc = ctx;
+    job_finish(gc->batch, gc->first + lane, cpu, gc->batch->prefix_done + executed);
+}
+
+static void run_group(struct Batch *b, int first, int count, struct CPU *cpu, struct Lockstep *g) {
+    struct GroupCtx gc = { b, first };
+
+    lockstep_init(g);
+    for (int l = 0; l < count; l++) {
+        job_load(b, first + l, cpu);
+        if (!lockstep_set_lane(g, l, cpu)) {
+            job_finish(b, first + l, cpu, b->prefix_done);   // uses memory lanes don't hold
+        }
+    }
+    lockstep_run(g, b->limit - b->prefix_done, cpu, group_eject, &gc);
+}
+
+static void *worker_main(void *arg) {
+    struct Worker *w = arg;
+    struct CPU *cpu = calloc(1, sizeof(struct CPU));
+    if (cpu == NULL) return NULL;
+    struct Lockstep *group = NULL;
+    if (w->batch->use_jit) cpu->jit = jit_create();
+    if (w->batch->use_lockstep) {
+        // Without memory for a group this worker just runs jobs one by one
+        group = aligned_alloc(sizeof(lane_vec), sizeof(struct Lockstep));
+    }
+
+    for (;;) {
+        int job, taken = deque_pop(w->batch, &w->deques[w->id], group ? LANES : 1, &job);
+        if (taken == 0) {
+            // Own deque is empty: try every other worker, starting next door
+            int stolen = 0;
+            for (int k = 1; k < w->count && !stolen; k++) {
+                stolen = deque_steal(&w->deques[w->id], &w->deques[(w->id + k) % w->count]);
+            }
+            if (stolen) {
+                w->jobs_stolen += stolen;
+            } else if (atomic_load(&w->batch->unclaimed) == 0) {
+                break;            // jobs are never added, so nothing is left
+            } else {
+                sched_yield();    // a steal elsewhere is in flight
+            }
+            continue;
+        }
+        if (group) {
+            run_group(w->batch, job, taken, cpu, group);
+        } else {
+            run_job(w->batch, job, cpu);
+        }
+        w->jobs_run += taken;
+    }
+
+    free(group);
+    jit_destroy(cpu->jit);
+    cpu_release(cpu);
+    free(cpu);
+    return NULL;
+}
+
+/* ---------------- Input ---------------- */
+
+// Parse one "R3=5 M100=0x20" line into job; returns 0 on a bad token
+static int parse_job(char *line, struct BatchJob *job, int line_no) {
+    for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+        char *eq = strchr(tok, '=');
+        char *end;
+        long target, value;
+
+        if (eq == NULL || (tok[0] != 'R' && tok[0] != 'M')) goto bad;
+        target = strtol(tok + 1, &end, 0);
+        if (end != eq) goto bad;
+        value = strtol(eq + 1, &end, 0);
+        if (*end != '\0' || value < -32768 || value > 0xFFFF) goto bad;
+
+        if (tok[0] == 'R') {
+            if (target < 0 || target > 7) goto bad;
+            job->reg[target] = (word_t)value;
+            job->reg_set |= (uint8_t)(1u << target);
+        } else {
+            if (target < 0 || target >= ADDRESS_SPACE) goto bad;
+            struct Poke *grown = realloc(job->pokes, (job->poke_count + 1) * sizeof(struct Poke));
+            if (grown == NULL) return 0;
+            job->pokes = grown;
+            job->pokes[job->poke_count++] = (struct Poke){ (word_t)target, (word_t)value };
+        }
+        continue;
+bad:
+        fprintf(stderr, "Error on line %d: Bad assignment '%s'\n", line_no, tok);
+        return 0;
+    }
+    return 1;
+}
+
+static struct BatchJob *read_jobs(const char *path, int *count) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: Cannot open job file '%s'\n", path);
+        return NULL;
+    }
+
+    struct BatchJob *jobs = NULL;
+    int n = 0, cap = 0, line_no = 0;
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        if (strspn(line, " \t\r\n") == strlen(line)) continue;
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 64;
+            struct BatchJob *grown = realloc(jobs, cap * sizeof(struct BatchJob));
+            if (grown == NULL) break;
+            jobs = grown;
+        }
+        memset(&jobs[n], 0, sizeof(jobs[n]));
+        if (!parse_job(line, &jobs[n], line_no)) {
+            fclose(fp);
+            for (int i = 0; i <= n; i++) free(jobs[i].pokes);
+            free(jobs);
+            return NULL;
+        }
+        n++;
+    }
+    fclose(fp);
+    *count = n;
+    return jobs;
+}
+
+// Run the first prefix instructions once and keep the state as the
+// checkpoint every job starts from; the prefix prints to stdout
+static int run_prefix(struct Batch *b, uint64_t prefix) {
+    struct CPU *cpu = calloc(1, sizeof(struct CPU));
+    b->checkpoint = malloc(sizeof(struct CPUSnapshot));
+    if (!cpu || !b->checkpoint) return 0;
+
+    if (prefix > b->limit) prefix = b->limit;
+    const struct Image *img = &b->program;
+    cpu_map_program(cpu, img->words, img->size, img->load, img->entry);
+    b->prefix_done = cpu_run(cpu, prefix).cycles;
+    if (cpu_is_halted(cpu)) {
+        b->use_lockstep = 0;   // lockstep groups only take running CPUs
+        fprintf(stderr, "[BATCH] Program stopped (%s) within the %llu-instruction prefix\n",
+                cpu->fault ? cpu->fault : "HALT", (unsigned long long)prefix);
+    }
+    cpu_snapshot(cpu, b->checkpoint);
+    console_close(&cpu->console);
+    cpu_release(cpu);
+    free(cpu);
+    return 1;
+}
+
+/* ---------------- Report ---------------- */
+
+static void print_result(const struct Batch *b, int index) {
+    const struct BatchResult *res = &b->results[index];
+
+    printf("job %d: %s after %llu instructions\n", index,
+           res->hit_limit ? "LIMIT" : res->fault ? res->fault : "HALT",
+           (unsigned long long)res->executed);
+    printf("  ");
+    for (int r = 0; r < 8; r++) printf("R%d=%d ", r, res->gpr.reg[r]);
+    printf("IP=%d SP=%d\n", res->IP, res->SP);
+
+    if (res->region) {
+        printf("  mem[%u..%u]:", b->region_start, b->region_start + b->region_count - 1);
+        for (unsigned i = 0; i < b->region_count; i++) printf(" %d", res->region[i]);
+        printf("\n");
+    }
+    if (res->output_len) {
+        printf("  output: \"");
+        for (size_t i = 0; i < res->output_len; i++) {
+            unsigned char c = (unsigned char)res->output[i];
+            if (c == '\n') printf("\\n");
+            else if (c == '"' || c == '\\') printf("\\%c", c);
+            else if (c < 32 || c > 126) printf("\\x%02X", c);
+            else putchar(c);
+        }
+        printf("\"\n");
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct Batch batch = {0};
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *image_path = NULL, *jobs_path = NULL;
+    uint64_t prefix = 0;
+
+    batch.limit = BATCH_DEFAULT_LIMIT;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-j") == 0) {
+            batch.use_jit = 1;
+        } else if (strcmp(argv[i], "-s") == 0) {
+            batch.use_lockstep = 1;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            batch.limit = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-P") == 0 && i + 1 < argc) {
+            prefix = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            unsigned start = 0, count = 0;
+            if (sscanf(argv[++i], "%u:%u", &start, &count) != 2 ||
+                start >= ADDRESS_SPACE || count > ADDRESS_SPACE - start) {
+                fprintf(stderr, "Error: -m expects addr:count inside %d words\n", ADDRESS_SPACE);
+                return 1;
+            }
+            batch.region_start = start;
+            batch.region_count = count;
+        } else if (!image_path) {
+            image_path = argv[i];
+        } else {
+            jobs_path = argv[i];
+        }
+    }
+    if (!image_path || !jobs_path) {
+        printf("CMPE220 Batch Runner\n");
+        printf("Usage: %s [-j] [-s] [-t threads] [-n max_instr] [-P prefix] [-m addr:count] "
+               "program.bin jobs.txt\n", argv[0]);
+        printf("  Runs program.bin once per line of jobs.txt, e.g. \"R0=5 M100=7\"\n");
+        return 1;
+    }
+
+    const char *err = image_open(image_path, &batch.program);
+    if (err) {
+        fprintf(stderr, "Error: '%s': %s\n", image_path, err);
+        return 1;
+    }
+    if (prefix && !run_prefix(&batch, prefix)) return 1;
+    batch.jobs = read_jobs(jobs_path, &batch.job_count);
+    if (!batch.jobs) return 1;
+    batch.results = calloc(batch.job_count ? batch.job_count : 1, sizeof(struct BatchResult));
+    if (!batch.results) return 1;
+
+    if (threads < 1) threads = 1;
+    if (threads > batch.job_count) threads = batch.job_count ? batch.job_count : 1;
+    atomic_init(&batch.unclaimed, batch.job_count);
+
+    // Deal the jobs out in contiguous blocks; stealing evens out the rest
+    struct Deque *deques = calloc(threads, sizeof(struct Deque));
+    struct Worker *workers = calloc(threads, sizeof(struct Worker));
+    if (!deques || !workers) return 1;
+    for (int t = 0; t < threads; t++) {
+        pthread_mutex_init(&deques[t].lock, NULL);
+        deques[t].head = (int)((long long)batch.job_count * t / threads);
+        deques[t].tail = (int)((long long)batch.job_count * (t + 1) / threads);
+    }
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int t = 0; t < threads; t++) {
+        workers[t] = (struct Worker){ .batch = &batch, .deques = deques, .id = t, .count = threads };
+        if (pthread_create(&workers[t].thread, NULL, worker_main, &workers[t]) != 0) {
+            fprintf(stderr, "Error: Cannot start worker thread %d\n", t);
+            return 1;
+        }
+    }
+    int stolen = 0;
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t].thread, NULL);
+        stolen += workers[t].jobs_stolen;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    uint64_t total = 0;
+    for (int i = 0; i < batch.job_count; i++) {
+        print_result(&batch, i);
+        total += batch.results[i].executed;
+    }
+
+    double seconds = (double)(t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "[BATCH] %d jobs on %d threads, %llu instructions in %.3f s "
+                    "(%.1f MIPS), %d jobs stolen\n",
+            batch.job_count, threads, (unsigned long long)total, seconds,
+            seconds > 0 ? total / seconds / 1e6 : 0.0, stolen);
+
+    for (int i = 0; i < batch.job_count; i++) {
+        free(batch.jobs[i].pokes);
+        free(batch.results[i].region);
+        free(batch.results[i].output);
+    }
+    for (int t = 0; t < threads; t++) pthread_mutex_destroy(&deques[t].lock);
+    free(deques);
+    free(workers);
+    free(batch.jobs);
+    free(batch.results);
+    if (batch.checkpoint) cpu_snapshot_free(batch.checkpoint);
+    free(batch.checkpoint);
+    image_close(&batch.program);
+    return 0;
+}
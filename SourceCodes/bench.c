@@ -0,0 +1,285 @@
+// bench.c
+// Measures emulator throughput on assembled program images.
+//
+// Every image is run to HALT again and again on each execution backend.
+// Runs are grouped into samples of at least -T milliseconds, so short
+// programs such as hello.bin still give stable numbers; only the time
+// spent inside cpu_run/cpu_step counts, not reloading the image. One
+// warm-up sample per image and backend is thrown away.
+//
+// Backends:
+//   interp     predecoded interpreter with superinstructions (cpu_run)
+//   step       one cpu_step call per instruction, no fusion
+//   reference  interpreter on the gate-level reference ALU
+//   jit        x86-64 compiled tier; recompiled on every run since
+//              loading the image drops compiled code (skipped elsewhere)
+//
+// Usage: bench [-r samples] [-T ms] [-n max_instr] [-b backend,...]
+//              [-f text|csv|json] [-o file] program.bin...
+// Build: gcc -std=c11 -O2 bench.c image.c cpu.c -o bench -lm
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE   // clock_gettime under -std=c11
+#endif
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "cpu.h"
+#include "image.h"
+
+#define BENCH_DEFAULT_SAMPLES 10
+#define BENCH_DEFAULT_SAMPLE_MS 50
+#define BENCH_DEFAULT_LIMIT 100000000ULL  // instructions before a run is cut off
+#define BENCH_MAX_SAMPLES 1000
+
+/* ---------------- Backends ---------------- */
+
+enum { BACKEND_INTERP, BACKEND_STEP, BACKEND_REFERENCE, BACKEND_JIT, BACKEND_COUNT };
+
+static const char *BACKEND_NAMES[BACKEND_COUNT] = { "interp", "step", "reference", "jit" };
+
+// One image measured on one backend
+struct BenchResult {
+    const char *program;
+    const char *backend;
+    const char *status;       // "halt", "limit" or the fault message
+    uint64_t instructions;    // per run
+    int samples;
+    double mips;              // from the mean ns/instr
+    double ns_mean, ns_stddev, ns_min, ns_max;
+};
+
+struct Bench {
+    int samples;
+    double sample_ns;
+    uint64_t limit;
+    int enabled[BACKEND_COUNT];
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Run the loaded program to the end on backend; returns instructions executed
+static uint64_t bench_run_once(const struct Bench *b, int backend, struct CPU *cpu) {
+    if (backend == BACKEND_STEP) {
+        uint64_t n = 0;
+        while (n < b->limit && cpu_step(cpu)) n++;
+        return n;
+    }
+    return cpu_run(cpu, b->limit).cycles;
+}
+
+// Time runs of image until sample_ns of emulation has passed; returns ns per instruction
+static double bench_sample(const struct Bench *b, int backend, struct CPU *cpu,
+                           const struct Image *image, uint64_t *per_run) {
+    double elapsed = 0;
+    uint64_t total = 0;
+
+    do {
+        cpu_reset(cpu);
+        cpu_map_program(cpu, image->words, image->size, image->load, image->entry);
+
+        double t0 = now_ns();
+        uint64_t n = bench_run_once(b, backend, cpu);
+        elapsed += now_ns() - t0;
+
+        console_close(&cpu->console);   // drop captured output between runs
+        *per_run = n;
+        total += n;
+    } while (elapsed < b->sample_ns && total > 0);
+
+    return total ? elapsed / total : 0;
+}
+
+// Measure one image on one backend; returns 0 if the backend is unavailable
+static int bench_measure(const struct Bench *b, int backend, const char *name,
+                         const struct Image *image, struct BenchResult *res) {
+    static struct CPU cpu;
+    double ns[BENCH_MAX_SAMPLES];
+
+    memset(&cpu, 0, sizeof(cpu));
+    console_open(&cpu.console, CONSOLE_CAPTURE, NULL, 0);
+    if (backend == BACKEND_REFERENCE) cpu.alu_mode = ALU_REFERENCE;
+    if (backend == BACKEND_JIT && (cpu.jit = jit_create()) == NULL) return 0;
+
+    memset(res, 0, sizeof(*res));
+    res->program = name;
+    res->backend = BACKEND_NAMES[backend];
+    res->samples = b->samples;
+
+    bench_sample(b, backend, &cpu, image, &res->instructions);   // warm-up
+    res->status = cpu.fault ? cpu.fault : cpu_is_halted(&cpu) ? "halt" : "limit";
+
+    double sum = 0, sq = 0;
+    for (int s = 0; s < b->samples; s++) {
+        ns[s] = bench_sample(b, backend, &cpu, image, &res->instructions);
+        sum += ns[s];
+        if (s == 0 || ns[s] < res->ns_min) res->ns_min = ns[s];
+        if (s == 0 || ns[s] > res->ns_max) res->ns_max = ns[s];
+    }
+    res->ns_mean = sum / b->samples;
+    for (int s = 0; s < b->samples; s++) sq += (ns[s] - res->ns_mean) * (ns[s] - res->ns_mean);
+    res->ns_stddev = b->samples > 1 ? sqrt(sq / (b->samples - 1)) : 0;
+    res->mips = res->ns_mean > 0 ? 1e3 / res->ns_mean : 0;
+
+    jit_destroy(cpu.jit);
+    cpu_release(&cpu);
+    return 1;
+}
+
+/* ---------------- Input ---------------- */
+
+// Enable the backends named in a comma-separated list
+static int parse_backends(struct Bench *b, char *list) {
+    memset(b->enabled, 0, sizeof(b->enabled));
+    for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        int k = 0;
+        while (k < BACKEND_COUNT && strcmp(tok, BACKEND_NAMES[k]) != 0) k++;
+        if (k == BACKEND_COUNT) {
+            fprintf(stderr, "Error: Unknown backend '%s'\n", tok);
+            return 0;
+        }
+        b->enabled[k] = 1;
+    }
+    return 1;
+}
+
+/* ---------------- Report ---------------- */
+
+enum { FORMAT_TEXT, FORMAT_CSV, FORMAT_JSON };
+
+// Write s as a JSON string (program paths and fault messages)
+static void json_string(FILE *out, const char *s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 32) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void print_results(FILE *out, int format, const struct BenchResult *res, int count) {
+    if (format == FORMAT_CSV) {
+        fprintf(out, "program,backend,status,instructions,samples,mips,"
+                     "ns_per_instr,ns_stddev,ns_min,ns_max\n");
+        for (int i = 0; i < count; i++) {
+            const struct BenchResult *r = &res[i];
+            fprintf(out, "%s,%s,\"%s\",%llu,%d,%.2f,%.3f,%.3f,%.3f,%.3f\n",
+                    r->program, r->backend, r->status, (unsigned long long)r->instructions,
+                    r->samples, r->mips, r->ns_mean, r->ns_stddev, r->ns_min, r->ns_max);
+        }
+    } else if (format == FORMAT_JSON) {
+        fprintf(out, "[\n");
+        for (int i = 0; i < count; i++) {
+            const struct BenchResult *r = &res[i];
+            fprintf(out, "  {\"program\": ");
+            json_string(out, r->program);
+            fprintf(out, ", \"backend\": \"%s\", \"status\": ", r->backend);
+            json_string(out, r->status);
+            fprintf(out, ", \"instructions\": %llu, \"samples\": %d, \"mips\": %.2f, "
+                         "\"ns_per_instr\": %.3f, \"ns_stddev\": %.3f, \"ns_min\": %.3f, "
+                         "\"ns_max\": %.3f}%s\n",
+                    (unsigned long long)r->instructions, r->samples, r->mips,
+                    r->ns_mean, r->ns_stddev, r->ns_min, r->ns_max, i + 1 < count ? "," : "");
+        }
+        fprintf(out, "]\n");
+    } else {
+        fprintf(out, "%-24s %-10s %12s %9s %9s %8s %7s  %s\n",
+                "program", "backend", "instr/run", "MIPS", "ns/instr", "stddev", "cv%", "status");
+        for (int i = 0; i < count; i++) {
+            const struct BenchResult *r = &res[i];
+            fprintf(out, "%-24s %-10s %12llu %9.1f %9.3f %8.3f %6.1f%%  %s\n",
+                    r->program, r->backend, (unsigned long long)r->instructions, r->mips,
+                    r->ns_mean, r->ns_stddev,
+                    r->ns_mean > 0 ? 100 * r->ns_stddev / r->ns_mean : 0, r->status);
+        }
+    }
+}
+
+int main(int argc, char *argv[]) {
+    struct Bench bench = {
+        .samples = BENCH_DEFAULT_SAMPLES,
+        .sample_ns = BENCH_DEFAULT_SAMPLE_MS * 1e6,
+        .limit = BENCH_DEFAULT_LIMIT,
+        .enabled = { 1, 1, 1, 1 },
+    };
+    int format = FORMAT_TEXT;
+    const char *out_path = NULL;
+    int first_image = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            bench.samples = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-T") == 0 && i + 1 < argc) {
+            bench.sample_ns = atof(argv[++i]) * 1e6;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            bench.limit = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            if (!parse_backends(&bench, argv[++i])) return 1;
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "text") == 0) format = FORMAT_TEXT;
+            else if (strcmp(argv[i], "csv") == 0) format = FORMAT_CSV;
+            else if (strcmp(argv[i], "json") == 0) format = FORMAT_JSON;
+            else {
+                fprintf(stderr, "Error: -f expects text, csv or json\n");
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_path = argv[++i];
+        } else {
+            first_image = i;
+            break;
+        }
+    }
+    if (first_image == argc) {
+        printf("CMPE220 Emulator Benchmark\n");
+        printf("Usage: %s [-r samples] [-T ms] [-n max_instr] [-b backend,...] "
+               "[-f text|csv|json] [-o file] program.bin...\n", argv[0]);
+        printf("  Backends: interp, step, reference, jit (default: all available)\n");
+        return 1;
+    }
+    if (bench.samples < 1) bench.samples = 1;
+    if (bench.samples > BENCH_MAX_SAMPLES) bench.samples = BENCH_MAX_SAMPLES;
+
+    int images = argc - first_image;
+    struct BenchResult *results = calloc((size_t)images * BACKEND_COUNT, sizeof(struct BenchResult));
+    if (!results) return 1;
+    int count = 0;
+
+    for (int i = first_image; i < argc; i++) {
+        struct Image image;
+        const char *err = image_open(argv[i], &image);
+        if (err) {
+            fprintf(stderr, "Error: '%s': %s\n", argv[i], err);
+            return 1;
+        }
+
+        for (int k = 0; k < BACKEND_COUNT; k++) {
+            if (!bench.enabled[k]) continue;
+            if (bench_measure(&bench, k, argv[i], &image, &results[count])) {
+                count++;
+            } else {
+                fprintf(stderr, "Note: backend '%s' is not available on this host\n", BACKEND_NAMES[k]);
+            }
+        }
+        image_close(&image);
+    }
+
+    FILE *out = stdout;
+    if (out_path && (out = fopen(out_path, "w")) == NULL) {
+        fprintf(stderr, "Error: Cannot open output file '%s'\n", out_path);
+        return 1;
+    }
+    print_results(out, format, results, count);
+    if (out != stdout) fclose(out);
+    free(results);
+    return 0;
+}
@@ -1,65 +1,51 @@
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE   // mmap's MAP_ANONYMOUS under -std=c11
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
-#define WORD_SIZE 16
-#define STACK_SIZE 1000
-#define MMIO_CHAR_OUT 32  // Memory-mapped I/O address for character output
-
-typedef uint16_t word_t;
+#if defined(__x86_64__) && !defined(_WIN32)
+#include <sys/mman.h>
+#endif
 
-enum {
-    NOP, MOV, ADD, SUB, AND, OR, MUL, DIV,
-    JMP, JZ, CALL, RET, HALT, LOAD, STORE
-};
+#include "cpu.h"
 
 const char *OPCODE_STRINGS[] = {
     "NOP","MOV","ADD","SUB","AND","OR","MUL","DIV",
-    "JMP","JZ","CALL","RET","HALT","LOAD","STORE"
-};
-
-struct ALUFlags {
-    uint8_t zx, nx, zy, ny, f, no;   // control flags
-    uint8_t zr, ng, ov, cy;          // status flags
-};
-
-struct ALU {
-    word_t x, y, out;
-    struct ALUFlags flags;
-};
-
-struct Memory {
-    word_t mem[400];
+    "JMP","JZ","CALL","RET","HALT","LOAD","STORE","MOVW"
 };
 
-struct GPR {
-    word_t reg[8];
+// Indexed by COND_*
+static const char *BRANCH_STRINGS[] = {
+    "JZ","JNZ","JN","JNN","JC","JO","JNC","DJNZ"
 };
 
-struct SPR {
-    word_t SP;
-};
+/* ---------------- ALU control words ---------------- */
 
-struct CU {
-    word_t IP, IR;
-    struct ALUFlags aluflags;
-};
+static uint8_t alu_control_word(const struct ALUFlags *f) {
+    return (uint8_t)((f->zx << 5) | (f->nx << 4) | (f->zy << 3) |
+                     (f->ny << 2) | (f->f  << 1) |  f->no);
+}
 
-struct CPU {
-    struct Memory mainMemory;
-    struct GPR gpr;
-    struct SPR spr;
-    struct CU cu;
-    struct ALU alu;
-    int running;
-    word_t static_counter;   // recursion depth tracker
-};
+void alu_set_control(struct ALUFlags *f, uint8_t d) {
+    f->zx = (d >> 5) & 1;
+    f->nx = (d >> 4) & 1;
+    f->zy = (d >> 3) & 1;
+    f->ny = (d >> 2) & 1;
+    f->f  = (d >> 1) & 1;
+    f->no = d & 1;
+}
 
-/* ---------------- N-bit helpers ---------------- */
+/* ---------------- N-bit helpers (gate-level reference) ---------------- */
 
-// N-bit adder implementation
-static word_t add_nbit(word_t a, word_t b, uint8_t *carry_out) {
+// N-bit ripple-carry adder implementation
+static word_t add_nbit(word_t a, word_t b, uint8_t carry_in, uint8_t *carry_out) {
     word_t sum = 0;
-    word_t carry = 0;
+    word_t carry = carry_in;
 
     for (int i = 0; i < WORD_SIZE; i++) {
         word_t bit_a = (a >> i) & 1u;
@@ -89,7 +75,23 @@ static word_t or_nbit(word_t a, word_t b) {
     return result;
 }
 
-/* ---------------- ALU core ---------------- */
+// a + b through the adder, with carry and signed-overflow flags
+static word_t add_ref(word_t a, word_t b, struct ALUFlags *f) {
+    word_t out = add_nbit(a, b, 0, &f->cy);
+    f->ov = (((a ^ out) & (b ^ out)) >> (WORD_SIZE - 1)) & 1u;
+    return out;
+}
+
+// a - b as a + ~b + 1 through the adder; CY reports the borrow
+static word_t sub_ref(word_t a, word_t b, struct ALUFlags *f) {
+    uint8_t carry;
+    word_t out = add_nbit(a, (word_t)~b, 1, &carry);
+    f->cy = !carry;
+    f->ov = (((a ^ b) & (a ^ out)) >> (WORD_SIZE - 1)) & 1u;
+    return out;
+}
+
+/* ---------------- ALU core (gate-level reference) ---------------- */
 
 static void alu_compute(struct ALU *alu) {
     word_t x = alu->x;
@@ -98,104 +100,58 @@ static void alu_compute(struct ALU *alu) {
     alu->flags.cy = 0;
     alu->flags.ov = 0;
 
-    if (alu->flags.zx) x = 0;
-    if (alu->flags.zy) y = 0;
-    if (alu->flags.nx) x = (word_t)~x;
-    if (alu->flags.ny) y = (word_t)~y;
+    uint8_t d = alu_control_word(&alu->flags);
 
-    uint8_t d = (uint8_t)((alu->flags.zx << 5) |
-                          (alu->flags.nx << 4) |
-                          (alu->flags.zy << 3) |
-                          (alu->flags.ny << 2) |
-                          (alu->flags.f  << 1) |
-                           alu->flags.no);
-
-    if (d == 0b101010) {
+    if (d == ALU_ZERO) {
         alu->out = 0;
-    } else if (d == 0b111111) {
+    } else if (d == ALU_ONE) {
         alu->out = 1;
-    } else if (d == 0b111010) {
+    } else if (d == ALU_NEG_ONE) {
         alu->out = (word_t)-1;
-    } else if (d == 0b001100) {
+    } else if (d == ALU_X) {
         alu->out = x;
-    } else if (d == 0b110000) {
+    } else if (d == ALU_Y) {
         alu->out = y;
-    } else if (d == 0b001101) {
+    } else if (d == ALU_NOT_X) {
         alu->out = (word_t)~x;
-    } else if (d == 0b110001) {
+    } else if (d == ALU_NOT_Y) {
         alu->out = (word_t)~y;
-    } else if (d == 0b001111) {
-        alu->out = (word_t)(-((int16_t)x));
-    } else if (d == 0b110011) {
-        alu->out = (word_t)(-((int16_t)y));
-    } else if (d == 0b011111) {
-        uint8_t carry;
-        alu->out = add_nbit(x, 1, &carry);
-        alu->flags.cy = carry;
-    } else if (d == 0b110111) {
-        uint8_t carry;
-        alu->out = add_nbit(y, 1, &carry);
-        alu->flags.cy = carry;
-    } else if (d == 0b001110) {
-        alu->out = (word_t)(x - 1);
-    } else if (d == 0b110010) {
-        alu->out = (word_t)(y - 1);
-    } else if (d == 0b000010) { // Addition (x + y)
-        uint8_t carry;
-        alu->out = add_nbit(x, y, &carry);
-        alu->flags.cy = carry;
-
-        int16_t sx   = (int16_t)x;
-        int16_t sy   = (int16_t)y;
-        int16_t sres = (int16_t)alu->out;
-
-        alu->flags.ov = ((sx > 0 && sy > 0 && sres < 0) ||
-                         (sx < 0 && sy < 0 && sres > 0));
-    } else if (d == 0b010011) { // Subtraction x - y
-        int16_t sx   = (int16_t)x;
-        int16_t sy   = (int16_t)y;
-        int16_t sres = (int16_t)(sx - sy);
-
-        alu->out = (word_t)sres;
-        alu->flags.cy = (sx < sy);
-        alu->flags.ov = ((sx > 0 && sy < 0 && sres < 0) ||
-                         (sx < 0 && sy > 0 && sres > 0));
-    } else if (d == 0b000111) { // Subtraction y - x
-        int16_t sx   = (int16_t)x;
-        int16_t sy   = (int16_t)y;
-        int16_t sres = (int16_t)(sy - sx);
-
-        alu->out = (word_t)sres;
-        alu->flags.cy = (sy < sx);
-        alu->flags.ov = ((sy > 0 && sx < 0 && sres < 0) ||
-                         (sy < 0 && sx > 0 && sres > 0));
-    } else if (d == 0b000000) { // AND
+    } else if (d == ALU_NEG_X) {
+        alu->out = sub_ref(0, x, &alu->flags);
+    } else if (d == ALU_NEG_Y) {
+        alu->out = sub_ref(0, y, &alu->flags);
+    } else if (d == ALU_X_INC) {
+        alu->out = add_ref(x, 1, &alu->flags);
+    } else if (d == ALU_Y_INC) {
+        alu->out = add_ref(y, 1, &alu->flags);
+    } else if (d == ALU_X_DEC) {
+        alu->out = sub_ref(x, 1, &alu->flags);
+    } else if (d == ALU_Y_DEC) {
+        alu->out = sub_ref(y, 1, &alu->flags);
+    } else if (d == ALU_ADD) {
+        alu->out = add_ref(x, y, &alu->flags);
+    } else if (d == ALU_SUB) {
+        alu->out = sub_ref(x, y, &alu->flags);
+    } else if (d == ALU_RSUB) {
+        alu->out = sub_ref(y, x, &alu->flags);
+    } else if (d == ALU_AND) {
         alu->out = x & y;
-        alu->flags.cy = 0;
-        alu->flags.ov = 0;
-    } else if (d == 0b010101) { // OR
+    } else if (d == ALU_OR) {
         alu->out = or_nbit(x, y);
-        alu->flags.cy = 0;
-        alu->flags.ov = 0;
-    } else if (d == 0b111100) { // Multiplication
+    } else if (d == ALU_MUL) {
         uint32_t prod = (uint32_t)x * (uint32_t)y;
         alu->out = (word_t)prod;
         alu->flags.cy = (prod > 0xFFFFu);
         alu->flags.ov = alu->flags.cy;
-    } else if (d == 0b111101) { // Division
+    } else if (d == ALU_DIV) {
         if (y == 0) {
-            printf("Error: Division by zero. CPU Halting.\n");
             alu->out = 0;
-            alu->flags.cy = 0;
             alu->flags.ov = 1;
         } else {
             alu->out = (word_t)(x / y);
-            alu->flags.cy = 0;
-            alu->flags.ov = 0;
         }
     } else {
-        alu->out = 0;
-        printf("Not a defined instruction in ISA\n");
+        alu->out = 0;   // not a defined instruction in ISA
     }
 
     // Update zero and negative flags for all operations
@@ -203,24 +159,118 @@ static void alu_compute(struct ALU *alu) {
     alu->flags.ng = ((alu->out & (1u << (WORD_SIZE - 1))) != 0);
 }
 
+/* ---------------- ALU fast path ---------------- */
+
+// Word-level handlers: compute out and set CY/OV; ZR/NG are set by alu_exec
+typedef word_t (*alu_fn)(word_t x, word_t y, struct ALUFlags *f);
+
+static word_t alu_fast_add(word_t x, word_t y, struct ALUFlags *f) {
+    uint32_t r = (uint32_t)x + y;
+    f->cy = (uint8_t)(r >> WORD_SIZE);
+    f->ov = (((x ^ r) & (y ^ r)) >> (WORD_SIZE - 1)) & 1u;
+    return (word_t)r;
+}
+
+static word_t alu_fast_sub(word_t x, word_t y, struct ALUFlags *f) {
+    word_t r = (word_t)(x - y);
+    f->cy = (x < y);
+    f->ov = (((x ^ y) & (x ^ r)) >> (WORD_SIZE - 1)) & 1u;
+    return r;
+}
+
+static word_t alu_fast_rsub(word_t x, word_t y, struct ALUFlags *f)  { return alu_fast_sub(y, x, f); }
+static word_t alu_fast_x_inc(word_t x, word_t y, struct ALUFlags *f) { (void)y; return alu_fast_add(x, 1, f); }
+static word_t alu_fast_y_inc(word_t x, word_t y, struct ALUFlags *f) { (void)x; return alu_fast_add(y, 1, f); }
+static word_t alu_fast_x_dec(word_t x, word_t y, struct ALUFlags *f) { (void)y; return alu_fast_sub(x, 1, f); }
+static word_t alu_fast_y_dec(word_t x, word_t y, struct ALUFlags *f) { (void)x; return alu_fast_sub(y, 1, f); }
+static word_t alu_fast_neg_x(word_t x, word_t y, struct ALUFlags *f) { (void)y; return alu_fast_sub(0, x, f); }
+static word_t alu_fast_neg_y(word_t x, word_t y, struct ALUFlags *f) { (void)x; return alu_fast_sub(0, y, f); }
+
+static word_t alu_fast_and(word_t x, word_t y, struct ALUFlags *f)     { (void)f; return x & y; }
+static word_t alu_fast_or(word_t x, word_t y, struct ALUFlags *f)      { (void)f; return x | y; }
+static word_t alu_fast_x(word_t x, word_t y, struct ALUFlags *f)       { (void)y; (void)f; return x; }
+static word_t alu_fast_y(word_t x, word_t y, struct ALUFlags *f)       { (void)x; (void)f; return y; }
+static word_t alu_fast_not_x(word_t x, word_t y, struct ALUFlags *f)   { (void)y; (void)f; return (word_t)~x; }
+static word_t alu_fast_not_y(word_t x, word_t y, struct ALUFlags *f)   { (void)x; (void)f; return (word_t)~y; }
+static word_t alu_fast_zero(word_t x, word_t y, struct ALUFlags *f)    { (void)x; (void)y; (void)f; return 0; }
+static word_t alu_fast_one(word_t x, word_t y, struct ALUFlags *f)     { (void)x; (void)y; (void)f; return 1; }
+static word_t alu_fast_neg_one(word_t x, word_t y, struct ALUFlags *f) { (void)x; (void)y; (void)f; return (word_t)-1; }
+
+static word_t alu_fast_mul(word_t x, word_t y, struct ALUFlags *f) {
+    uint32_t prod = (uint32_t)x * (uint32_t)y;
+    f->cy = (prod > 0xFFFFu);
+    f->ov = f->cy;
+    return (word_t)prod;
+}
+
+static word_t alu_fast_div(word_t x, word_t y, struct ALUFlags *f) {
+    if (y == 0) {
+        f->ov = 1;
+        return 0;
+    }
+    return (word_t)(x / y);
+}
+
+// Indexed by the control word; NULL entries are undefined and yield 0
+static const alu_fn ALU_FAST_OPS[64] = {
+    [ALU_AND]     = alu_fast_and,     [ALU_ADD]     = alu_fast_add,
+    [ALU_RSUB]    = alu_fast_rsub,    [ALU_X]       = alu_fast_x,
+    [ALU_NOT_X]   = alu_fast_not_x,   [ALU_X_DEC]   = alu_fast_x_dec,
+    [ALU_NEG_X]   = alu_fast_neg_x,   [ALU_SUB]     = alu_fast_sub,
+    [ALU_OR]      = alu_fast_or,      [ALU_X_INC]   = alu_fast_x_inc,
+    [ALU_ZERO]    = alu_fast_zero,    [ALU_Y]       = alu_fast_y,
+    [ALU_NOT_Y]   = alu_fast_not_y,   [ALU_Y_DEC]   = alu_fast_y_dec,
+    [ALU_NEG_Y]   = alu_fast_neg_y,   [ALU_Y_INC]   = alu_fast_y_inc,
+    [ALU_NEG_ONE] = alu_fast_neg_one, [ALU_MUL]     = alu_fast_mul,
+    [ALU_DIV]     = alu_fast_div,     [ALU_ONE]     = alu_fast_one
+};
+
 /* ---------------- Encoding & debug helpers ---------------- */
 
-static word_t encodeI(uint8_t op, uint8_t r1, uint8_t r2, uint8_t imm) {
+word_t encodeI(uint8_t op, uint8_t r1, uint8_t r2, uint8_t imm) {
     return (word_t)(((op & 0xF) << 12) |
                     ((r1 & 0x7) << 9)  |
                     ((r2 & 0x7) << 6)  |
                      (imm & 0x3F));
 }
 
-static void dump_memory(struct CPU *cpu) {
+word_t encodeR(uint8_t op, uint8_t r1, uint8_t rs) {
+    return encodeI(op, r1, 1, rs & 0x7);
+}
+
+word_t encodeJ(uint8_t cond, uint8_t r1, uint8_t target) {
+    return encodeI(JZ, r1, cond, target);
+}
+
+const char *instr_name(word_t w) {
+    uint8_t op = (w >> 12) & 0xF;
+    if (op == JZ) return BRANCH_STRINGS[BRANCH_COND(w)];
+    return IS_CMP(w) ? "CMP" : OPCODE_STRINGS[op];
+}
+
+// Whether a conditional branch with cond is taken under flags f. DJNZ
+// has already decremented its counter, so it tests for a nonzero result.
+static int cond_holds(const struct ALUFlags *f, uint8_t cond) {
+    switch (cond) {
+    case COND_Z:  return f->zr;
+    case COND_N:  return f->ng;
+    case COND_NN: return !f->ng;
+    case COND_C:  return f->cy;
+    case COND_O:  return f->ov;
+    case COND_NC: return !f->cy;
+    default:      return !f->zr;   // COND_NZ, COND_DJNZ
+    }
+}
+
+void dump_memory(struct CPU *cpu) {
     printf("Memory Dump:\n");
     for (int j = 0; j < 32; j++) {
-        printf("%02X: %04X\n", j, cpu->mainMemory.mem[j]);
+        printf("%02X: %04X\n", j, cpu_peek(cpu, (word_t)j));
     }
-    printf("Recursion depth: %d\n", cpu->static_counter);
+    printf("Call depth: %d\n", cpu->static_counter);
 }
 
-static void dump_registers(struct CPU *cpu) {
+void dump_registers(struct CPU *cpu) {
     for (int j = 0; j < 8; j++) {
         printf("R%d=%d ", j, cpu->gpr.reg[j]);
     }
@@ -232,181 +282,2033 @@ static void dump_registers(struct CPU *cpu) {
            cpu->cu.aluflags.cy);
 }
 
-/* ---------------- Memory-Mapped I/O ---------------- */
+/* ---------------- Ring-buffer tracer ---------------- */
 
-static void memory_write(struct CPU *cpu, word_t address, word_t value) {
-    // Check for memory-mapped I/O
-    if (address == MMIO_CHAR_OUT) {
-        // Character output port
-        printf("%c", (char)(value & 0xFF));
-        fflush(stdout);
-    }
-    
-    // Always write to memory as well
-    if (address < 400) {
-        cpu->mainMemory.mem[address] = value;
-    }
+void trace_enable(struct CPU *cpu) {
+    cpu->trace.enabled = 1;
+    cpu->trace.count = 0;
 }
 
-static word_t memory_read(struct CPU *cpu, word_t address) {
-    if (address < 400) {
-        return cpu->mainMemory.mem[address];
-    }
-    return 0;
+static uint8_t pack_flags(const struct ALUFlags *f) {
+    return (uint8_t)(f->zr | (f->ng << 1) | (f->ov << 2) | (f->cy << 3));
 }
 
-/* ---------------- CPU core helpers ---------------- */
+// Build the record for the instruction just executed from IP
+static void trace_record(struct CPU *cpu, word_t ip, word_t ir,
+                         const struct GPR *before) {
+    struct TraceRecord rec = { ip, ir, 0, 0, -1,
+                               pack_flags(&cpu->cu.aluflags) };
 
-static void load_program(struct CPU *cpu, word_t *program, int size) {
-    for (int i = 0; i < size; i++) {
-        cpu->mainMemory.mem[i] = program[i];
+    for (int j = 0; j < 8; j++) {
+        if (cpu->gpr.reg[j] != before->reg[j]) {
+            rec.reg = (int8_t)j;
+            rec.before = before->reg[j];
+            rec.after = cpu->gpr.reg[j];
+            break;
+        }
+    }
+
+    if (cpu->trace.enabled) {
+        cpu->trace.rec[cpu->trace.count++ % TRACE_SIZE] = rec;
+    }
+    if (cpu->on_step) {
+        cpu->on_step(cpu, &rec);
     }
-    cpu->cu.IP = 0;
-    cpu->spr.SP = 399;   // top of stack
 }
 
-static void fetch_decode_execute(struct CPU *cpu) {
-    if (cpu->running == 0) return;
+// Print the buffered records, oldest first
+void trace_dump(const struct CPU *cpu, FILE *out) {
+    uint32_t count = cpu->trace.count;
+    uint32_t first = count > TRACE_SIZE ? count - TRACE_SIZE : 0;
+
+    fprintf(out, "Trace (last %u of %u instructions):\n",
+            (unsigned)(count - first), (unsigned)count);
+    for (uint32_t i = first; i < count; i++) {
+        const struct TraceRecord *rec = &cpu->trace.rec[i % TRACE_SIZE];
+
+        fprintf(out, "  #%-6u IP=%3d IR=0x%04X %-5s", (unsigned)i, rec->IP,
+                rec->IR, instr_name(rec->IR));
+        if (rec->reg >= 0) {
+            fprintf(out, " R%d: %5d -> %-5d", rec->reg, rec->before, rec->after);
+        } else {
+            fprintf(out, " %-18s", "");
+        }
+        fprintf(out, " ZR=%d NG=%d OV=%d CY=%d\n",
+                rec->flags & 1, (rec->flags >> 1) & 1,
+                (rec->flags >> 2) & 1, (rec->flags >> 3) & 1);
+    }
+}
 
-    cpu->cu.IR = cpu->mainMemory.mem[cpu->cu.IP++];
-    word_t instr = cpu->cu.IR;
+// Register line used by the cycle-by-cycle demos
+void print_register_line(const struct CPU *cpu) {
+    printf("  Registers: ");
+    for (int j = 0; j < 8; j++) {
+        printf("R%d=%d ", j, cpu->gpr.reg[j]);
+    }
+    printf("| IP=%d ", cpu->cu.IP);
+    printf("| Flags: ZR=%d\n", cpu->cu.aluflags.zr);
+}
 
-    uint8_t op  = (instr >> 12) & 0xF;
-    uint8_t r1  = (instr >> 9)  & 0x7;
-    uint8_t r2  = (instr >> 6)  & 0x7;
-    uint8_t imm = instr & 0x3F;
+// on_step hook that narrates each instruction as Fetch/Decode/Execute/Store
+void trace_print_cycle(struct CPU *cpu, const struct TraceRecord *rec) {
+    uint8_t op  = (rec->IR >> 12) & 0xF;
+    uint8_t r1  = (rec->IR >> 9)  & 0x7;
+    uint8_t r2  = (rec->IR >> 6)  & 0x7;
+    uint8_t imm = rec->IR & 0x3F;
+    word_t old_val = (rec->reg == r1) ? rec->before : cpu->gpr.reg[r1];
+    int reg_form = IS_REG_FORM(rec->IR);
+    uint8_t rs = imm & 0x7;
+    word_t operand = !reg_form ? imm : rs == r1 ? old_val : cpu->gpr.reg[rs];
 
-    printf("Executing: %s r1=%d r2=%d imm=%d\n",
-           OPCODE_STRINGS[op], r1, r2, imm);
+    printf("[Cycle %d] FETCH: IP=%d, IR=0x%04X\n", rec->IP, rec->IP, rec->IR);
+    printf("          DECODE: OP=%s, R1=%d, R2=%d, IMM=%d\n",
+           instr_name(rec->IR), r1, r2, imm);
 
-    if (op == NOP) {
-        // No operation
+    if (op == MOV && reg_form) {
+        printf("          EXECUTE: R%d = R%d = %d\n", r1, rs, operand);
     } else if (op == MOV) {
-        cpu->gpr.reg[r1] = imm;
+        printf("          EXECUTE: R%d = %d\n", r1, imm);
+    } else if (op == MOVW) {
+        printf("          EXECUTE: R%d = %d\n", r1, cpu->gpr.reg[r1]);
     } else if (op == ADD) {
-        cpu->alu.x = cpu->gpr.reg[r1];
-        cpu->alu.y = imm;
-        cpu->alu.flags = (struct ALUFlags){0,0,0,0,0,0,0,0,0,0};
-        alu_compute(&cpu->alu);
-        cpu->gpr.reg[r1] = cpu->alu.out;
-        cpu->cu.aluflags = cpu->alu.flags;
+        printf("          EXECUTE: R%d = %d + %d = %d\n",
+               r1, old_val, operand, cpu->gpr.reg[r1]);
+    } else if (op == SUB && IS_CMP(rec->IR)) {
+        printf("          EXECUTE: Compare %d - %d: ZR=%d NG=%d CY=%d\n",
+               old_val, operand, rec->flags & 1, (rec->flags >> 1) & 1,
+               (rec->flags >> 3) & 1);
     } else if (op == SUB) {
-        cpu->alu.x = cpu->gpr.reg[r1];
-        cpu->alu.y = imm;
-        cpu->alu.flags = (struct ALUFlags){0,0,1,0,1,1,0,0,0,0};
-        alu_compute(&cpu->alu);
-        cpu->gpr.reg[r1] = cpu->alu.out;
-        cpu->cu.aluflags = cpu->alu.flags;
-    } else if (op == AND) {
-        cpu->gpr.reg[r1] &= cpu->gpr.reg[r2];
-        cpu->cu.aluflags.zr = (cpu->gpr.reg[r1] == 0);
-        cpu->cu.aluflags.ng = ((cpu->gpr.reg[r1] & 0x8000u) != 0);
-    } else if (op == OR) {
-        cpu->gpr.reg[r1] |= cpu->gpr.reg[r2];
-        cpu->cu.aluflags.zr = (cpu->gpr.reg[r1] == 0);
-        cpu->cu.aluflags.ng = ((cpu->gpr.reg[r1] & 0x8000u) != 0);
-    } else if (op == MUL) {
-        cpu->alu.x = cpu->gpr.reg[r1];
-        cpu->alu.y = cpu->gpr.reg[r2];
-        cpu->alu.flags = (struct ALUFlags){0,0,0,0,0,0,0,0,0,0};
-        alu_compute(&cpu->alu);
-        cpu->gpr.reg[r1] = cpu->alu.out;
-        cpu->cu.aluflags = cpu->alu.flags;
-    } else if (op == DIV) {
-        if (cpu->gpr.reg[r2] == 0) {
-            printf("Division by zero!\n");
-            cpu->running = 0;
-            return;
-        }
-        cpu->gpr.reg[r1] = cpu->gpr.reg[r1] / cpu->gpr.reg[r2];
-        cpu->cu.aluflags.zr = (cpu->gpr.reg[r1] == 0);
-        cpu->cu.aluflags.ng = ((int16_t)cpu->gpr.reg[r1] < 0);
+        printf("          EXECUTE: R%d = %d - %d = %d, ZR=%d\n",
+               r1, old_val, operand, cpu->gpr.reg[r1], rec->flags & 1);
     } else if (op == JMP) {
-        cpu->cu.IP = imm;
+        printf("          EXECUTE: Jump to address %d\n", imm);
     } else if (op == JZ) {
-        if (cpu->cu.aluflags.zr) {
-            cpu->cu.IP = imm;
+        // The flag each condition tests, as an index into rec->flags
+        static const uint8_t COND_FLAG[] = { 0, 0, 1, 1, 3, 2, 3, 0 };
+        static const char *FLAG_NAMES[] = { "ZR", "NG", "OV", "CY" };
+        struct ALUFlags f = { .zr = rec->flags & 1, .ng = (rec->flags >> 1) & 1,
+                              .ov = (rec->flags >> 2) & 1, .cy = (rec->flags >> 3) & 1 };
+        uint8_t flag = COND_FLAG[r2];
+
+        printf("          EXECUTE: ");
+        if (r2 == COND_DJNZ) {
+            printf("R%d = %d - 1 = %d, ", r1, old_val, cpu->gpr.reg[r1]);
         }
-    } else if (op == CALL) {
-        if (cpu->spr.SP == 0) {
-            printf("Stack overflow!\n");
-            cpu->running = 0;
-            return;
+        if (cond_holds(&f, r2)) {
+            printf("Jump to address %d (%s=%d)\n", imm, FLAG_NAMES[flag],
+                   (rec->flags >> flag) & 1);
+        } else {
+            printf("No jump (%s=%d)\n", FLAG_NAMES[flag], (rec->flags >> flag) & 1);
         }
-        cpu->mainMemory.mem[cpu->spr.SP--] = cpu->cu.IP;
-        cpu->cu.IP = imm;
-        cpu->static_counter++;
-        fetch_decode_execute(cpu);
-        return;
+    } else if (op == CALL) {
+        printf("          EXECUTE: Call subroutine at %d\n", imm);
     } else if (op == RET) {
-        if (cpu->spr.SP >= 399) {
-            printf("Stack underflow!\n");
-            cpu->running = 0;
-            return;
-        }
-        cpu->cu.IP = cpu->mainMemory.mem[++cpu->spr.SP];
-        fetch_decode_execute(cpu);
-        return;
+        printf("          EXECUTE: Return\n");
     } else if (op == HALT) {
-        cpu->running = 0;
-        printf("[CPU] Program HALTED.\n");
+        printf("          EXECUTE: HALT\n");
+        printf("\n=== Program Complete ===\n");
         return;
-    } else if (op == LOAD) {
-        // LOAD R1, R2 - Load from memory[R2] into R1
-        word_t address = cpu->gpr.reg[r2];
-        cpu->gpr.reg[r1] = memory_read(cpu, address);
-    } else if (op == STORE) {
-        // STORE R1, R2 - Store R1 into memory[R2]
-        word_t address = cpu->gpr.reg[r2];
-        memory_write(cpu, address, cpu->gpr.reg[r1]);
+    } else if (rec->reg >= 0) {
+        printf("          EXECUTE: R%d = %d\n", rec->reg, rec->after);
     }
 
-    dump_registers(cpu);
+    if (!cpu->running) return;
+
+    printf("          STORE: ");
+    print_register_line(cpu);
+    printf("\n");
 }
 
-static void run_cpu(struct CPU *cpu) {
-    cpu->running = 1;
-    while (cpu->running) {
-        fetch_decode_execute(cpu);
-    }
-    dump_memory(cpu);
-}
-
-/* ---------------- Test program ---------------- */
-
-int main(void) {
-    struct CPU cpu = {0};
-
-    word_t test_program[] = {
-        // Test all opcodes
-        encodeI(NOP, 0, 0, 0),    // NOP
-        encodeI(MOV, 0, 0, 10),   // R0 = 10
-        encodeI(MOV, 1, 0, 5),    // R1 = 5
-        encodeI(ADD, 2, 0, 3),    // R2 = R2 + 3
-        encodeI(SUB, 0, 0, 2),    // R0 = R0 - 2
-        encodeI(MOV, 3, 0, 12),   // R3 = 12 (for AND/OR test)
-        encodeI(MOV, 4, 0, 9),    // R4 = 9 (for AND/OR test)
-        encodeI(AND, 3, 4, 0),    // R3 = R3 & R4
-        encodeI(OR,  4, 3, 0),    // R4 = R4 | R3
-        encodeI(MUL, 1, 0, 0),    // R1 = R1 * R0
-        encodeI(MOV, 5, 0, 100),  // R5 = 100
-        encodeI(MOV, 6, 0, 5),    // R6 = 5
-        encodeI(DIV, 5, 6, 0),    // R5 = R5 / R6
-        encodeI(JMP, 0, 0, 15),   // Jump to position 15
-        encodeI(HALT,0, 0, 0),    // This HALT will be skipped
-        encodeI(SUB, 6, 0, 5),    // R6 = R6 - 5
-        encodeI(JZ,  0, 0, 18),   // If ZR flag is set, jump to CALL
-        encodeI(HALT,0, 0, 0),    // This HALT will be skipped if R6 == 0
-        encodeI(CALL,0, 0, 20),   // Call subroutine
-        encodeI(HALT,0, 0, 0),    // Final HALT
-        // Subroutine
-        encodeI(MOV, 7, 0, 42),   // R7 = 42
-        encodeI(RET, 0, 0, 0)     // Return from subroutine
-    };
+/* ---------------- Execution profiler ---------------- */
+
+#define PROFILE_TOP 10   // hot addresses listed by profile_report
+
+struct Profile *profile_create(FILE *report) {
+    struct Profile *p = calloc(1, sizeof(struct Profile));
+    if (p) p->report = report;
+    return p;
+}
+
+void profile_destroy(struct Profile *p) {
+    free(p);
+}
+
+// Count the di->len instructions just executed from ip
+static void profile_count(struct CPU *cpu, word_t ip, const struct DecodedInstr *di) {
+    struct Profile *p = cpu->profile;
+
+    p->op[di->op]++;
+    p->addr[ip]++;
+    for (int k = 1; k < di->len; k++) {
+        ip += INSTR_WORDS(cpu_peek(cpu, ip));
+        p->op[cpu_peek(cpu, ip) >> 12]++;
+        p->addr[ip]++;
+    }
+
+    // Only the last instruction of a sequence (now at ip) can transfer control
+    uint8_t last = di->last >> 12;
+    if (last == JZ && cond_holds(&cpu->cu.aluflags, BRANCH_COND(di->last))) {
+        p->taken[ip]++;
+    } else if (last == CALL && cpu->fault == NULL) {
+        p->call[di->last & 0x3F]++;
+    } else if (last == HALT && p->report) {
+        profile_report(cpu, p->report);
+    }
+}
+
+struct ProfileEntry {
+    uint64_t count;
+    word_t key;
+};
+
+// Descending by count, then ascending by key
+static int profile_entry_cmp(const void *a, const void *b) {
+    const struct ProfileEntry *x = a, *y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return (x->key > y->key) - (x->key < y->key);
+}
+
+// Non-zero counts[] as entries sorted hottest first; returns how many
+static int profile_sort(const uint64_t *counts, int n, struct ProfileEntry *out) {
+    int used = 0;
+    for (int i = 0; i < n; i++) {
+        if (counts[i]) out[used++] = (struct ProfileEntry){ counts[i], (word_t)i };
+    }
+    qsort(out, used, sizeof(*out), profile_entry_cmp);
+    return used;
+}
+
+
+void profile_report(const struct CPU *cpu, FILE *out) {
+    const struct Profile *p = cpu->profile;
+    struct ProfileEntry e[CODE_SIZE];
+    uint64_t total = 0;
+    int n;
+
+    if (p == NULL) return;
+    for (int i = 0; i < 16; i++) total += p->op[i];
+    double pct = total ? 100.0 / total : 0;
+
+    fprintf(out, "Profile: %llu instructions\n", (unsigned long long)total);
+    fprintf(out, "  Opcodes:\n");
+    n = profile_sort(p->op, 16, e);
+    for (int i = 0; i < n; i++) {
+        // Every conditional branch shares the JZ opcode
+        fprintf(out, "    %-5s %12llu %6.2f%%\n",
+                e[i].key == JZ ? "Jcc" : OPCODE_STRINGS[e[i].key],
+                (unsigned long long)e[i].count, e[i].count * pct);
+    }
+
+    n = profile_sort(p->addr, CODE_SIZE, e);
+    fprintf(out, "  Hot addresses (top %d of %d):\n", n < PROFILE_TOP ? n : PROFILE_TOP, n);
+    for (int i = 0; i < n && i < PROFILE_TOP; i++) {
+        fprintf(out, "    IP=%3d %-5s %12llu %6.2f%%\n", e[i].key,
+                instr_name(cpu_peek(cpu, e[i].key)),
+                (unsigned long long)e[i].count, e[i].count * pct);
+    }
+
+    n = profile_sort(p->call, CODE_SIZE, e);
+    if (n) fprintf(out, "  CALL targets:\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(out, "    %3d %12llu calls\n", e[i].key, (unsigned long long)e[i].count);
+    }
+
+    // Conditional branch sites, hottest first; addr[] counts every execution
+    int sites = 0;
+    for (int i = 0; i < CODE_SIZE; i++) {
+        if (p->addr[i] && (cpu_peek(cpu, (word_t)i) >> 12) == JZ) {
+            e[sites++] = (struct ProfileEntry){ p->addr[i], (word_t)i };
+        }
+    }
+    qsort(e, sites, sizeof(*e), profile_entry_cmp);
+    if (sites) fprintf(out, "  Conditional branches:\n");
+    for (int i = 0; i < sites; i++) {
+        uint64_t taken = p->taken[e[i].key];
+        fprintf(out, "    IP=%3d %-4s taken %12llu  not taken %12llu  (%5.1f%% taken)\n",
+                e[i].key, instr_name(cpu_peek(cpu, e[i].key)), (unsigned long long)taken,
+                (unsigned long long)(e[i].count - taken), 100.0 * taken / e[i].count);
+    }
+}
+
+/* ---------------- Branch predictors ---------------- */
+
+#define PREDICT_MASK ((1u << PREDICT_TABLE_BITS) - 1)
+
+static const char *PREDICT_NAMES[PREDICT_KINDS] = { "none", "static", "2bit", "gshare" };
+static const char *XFER_NAMES[XFER_COUNT] = { "Branches", "JMP/CALL", "RET" };
+
+struct Predictor *predictor_create(int kind, int ras_depth, FILE *report) {
+    if (kind < 0 || kind >= PREDICT_KINDS) return NULL;
+    struct Predictor *p = calloc(1, sizeof(struct Predictor));
+    if (p == NULL) return NULL;
+    p->kind = (uint8_t)kind;
+    p->ras_depth = (uint8_t)(ras_depth < 0 ? 0 : ras_depth > PREDICT_RAS_MAX ? PREDICT_RAS_MAX : ras_depth);
+    memset(p->counter, 2, sizeof(p->counter));   // weakly taken
+    p->last = -1;
+    p->report = report;
+    return p;
+}
+
+void predictor_destroy(struct Predictor *p) {
+    free(p);
+}
+
+int predictor_kind(const char *name) {
+    for (int k = 0; k < PREDICT_KINDS; k++) {
+        if (strcmp(name, PREDICT_NAMES[k]) == 0) return k;
+    }
+    return -1;
+}
+
+// Guess whether the conditional branch at ip is taken, then train on taken
+static int predict_branch(struct Predictor *p, word_t ip, word_t target, int taken) {
+    int guess = 0;
+    uint8_t *c = NULL;
+
+    switch (p->kind) {
+    case PREDICT_STATIC:  guess = target <= ip; break;
+    case PREDICT_BIMODAL: c = &p->counter[ip & PREDICT_MASK]; break;
+    case PREDICT_GSHARE:  c = &p->counter[(ip ^ p->history) & PREDICT_MASK]; break;
+    }
+    if (c) {
+        guess = *c >= 2;
+        if (taken && *c < 3) (*c)++;
+        if (!taken && *c > 0) (*c)--;
+    }
+    p->history = (uint16_t)(p->history << 1 | taken);
+    return guess == taken;
+}
+
+// Predict instruction w, just executed from ip, and record the outcome
+static void predictor_update(struct CPU *cpu, word_t ip, word_t w) {
+    struct Predictor *p = cpu->predictor;
+    uint8_t op = w >> 12;
+    int kind, hit;
+
+    switch (op) {
+    case JZ:
+        kind = XFER_BRANCH;
+        hit = predict_branch(p, ip, w & 0x3F, cond_holds(&cpu->cu.aluflags, BRANCH_COND(w)));
+        break;
+    case JMP: case CALL:
+        kind = XFER_JUMP;
+        hit = p->kind != PREDICT_NONE;
+        if (op == CALL && p->ras_depth) {
+            p->ras_top = (uint8_t)((p->ras_top + 1) % p->ras_depth);
+            p->ras[p->ras_top] = (word_t)(ip + 1);
+            if (p->ras_used < p->ras_depth) p->ras_used++;
+        }
+        break;
+    case RET:
+        kind = XFER_RETURN;
+        hit = p->ras_used > 0 && p->ras[p->ras_top] == cpu->cu.IP;
+        if (p->ras_used > 0) {
+            p->ras_top = (uint8_t)((p->ras_top + p->ras_depth - 1) % p->ras_depth);
+            p->ras_used--;
+        }
+        break;
+    default:
+        p->last = -1;
+        if (op == HALT && p->report) predictor_report(cpu, p->report);
+        return;
+    }
+
+    p->last = (int8_t)hit;
+    p->seen[kind]++;
+    p->missed[kind] += !hit;
+    if (ip < CODE_SIZE) {
+        p->site_seen[ip]++;
+        p->site_missed[ip] += !hit;
+    }
+}
+
+void predictor_report(const struct CPU *cpu, FILE *out) {
+    const struct Predictor *p = cpu->predictor;
+    struct ProfileEntry e[CODE_SIZE];
+    uint64_t seen = 0, missed = 0;
+
+    if (p == NULL) return;
+    for (int k = 0; k < XFER_COUNT; k++) {
+        seen += p->seen[k];
+        missed += p->missed[k];
+    }
+
+    fprintf(out, "Branch prediction: %s, %d-entry return stack\n",
+            PREDICT_NAMES[p->kind], p->ras_depth);
+    fprintf(out, "  %-13s %12s %12s %8s\n", "", "executed", "mispredicted", "accuracy");
+    for (int k = 0; k <= XFER_COUNT; k++) {
+        uint64_t n = k < XFER_COUNT ? p->seen[k] : seen;
+        uint64_t m = k < XFER_COUNT ? p->missed[k] : missed;
+        fprintf(out, "  %-13s %12llu %12llu %7.2f%%\n", k < XFER_COUNT ? XFER_NAMES[k] : "Total",
+                (unsigned long long)n, (unsigned long long)m, n ? 100.0 * (n - m) / n : 100.0);
+    }
+
+    int n = profile_sort(p->site_missed, CODE_SIZE, e);
+    if (n) fprintf(out, "  Mispredicted sites (top %d of %d):\n", n < PROFILE_TOP ? n : PROFILE_TOP, n);
+    for (int i = 0; i < n && i < PROFILE_TOP; i++) {
+        uint64_t execs = p->site_seen[e[i].key];
+        fprintf(out, "    IP=%3d %-5s %12llu %12llu %7.2f%%\n", e[i].key,
+                instr_name(cpu_peek(cpu, e[i].key)), (unsigned long long)execs,
+                (unsigned long long)e[i].count, 100.0 * (execs - e[i].count) / execs);
+    }
+}
+
+/* ---------------- Cache model ---------------- */
+
+static const char *CACHE_NAMES[CACHE_LEVELS] = { "l1i", "l1d", "l2" };
+static const char *POLICY_NAMES[CACHE_POLICIES] = { "lru", "fifo", "random" };
+static const char *REGION_NAMES[REGION_COUNT] = { "code", "data", "stack" };
+
+static int cache_geometry_ok(const struct CacheGeometry *g) {
+    if (g->words == 0) return 1;
+    return g->line_words > 0 && (g->line_words & (g->line_words - 1)) == 0 &&
+           g->ways > 0 && g->policy < CACHE_POLICIES &&
+           g->words % ((uint32_t)g->line_words * g->ways) == 0;
+}
 
-    load_program(&cpu, test_program,
-                 sizeof(test_program) / sizeof(test_program[0]));
-    run_cpu(&cpu);
+struct Cache *cache_create(struct CacheConfig config, FILE *report) {
+    for (int k = 0; k < CACHE_LEVELS; k++) {
+        if (!cache_geometry_ok(&config.level[k])) return NULL;
+    }
+    struct Cache *c = calloc(1, sizeof(struct Cache));
+    if (c == NULL) return NULL;
+    c->config = config;
+    c->seed = 0x2545F491u;
+    c->report = report;
+    for (int k = 0; k < CACHE_LEVELS; k++) {
+        struct CacheLevel *l = &c->level[k];
+        l->geometry = config.level[k];
+        if (l->geometry.words == 0) continue;
+        l->sets = l->geometry.words / l->geometry.line_words / l->geometry.ways;
+        l->line = calloc(l->geometry.words / l->geometry.line_words, sizeof(struct CacheLine));
+        if (l->line == NULL) {
+            cache_destroy(c);
+            return NULL;
+        }
+    }
+    return c;
+}
+
+void cache_destroy(struct Cache *c) {
+    if (c == NULL) return;
+    for (int k = 0; k < CACHE_LEVELS; k++) free(c->level[k].line);
+    free(c);
+}
+
+const char *cache_configure(struct CacheConfig *config, const char *spec) {
+    char item[64];
+
+    while (*spec) {
+        size_t n = strcspn(spec, ",");
+        if (n >= sizeof(item)) return "setting too long";
+        memcpy(item, spec, n);
+        item[n] = '\0';
+        spec += n + (spec[n] == ',');
+
+        char *value = strchr(item, '=');
+        if (value == NULL) return "expected name=value";
+        *value++ = '\0';
+
+        int k = 0;
+        while (k < CACHE_LEVELS && strcmp(item, CACHE_NAMES[k]) != 0) k++;
+        if (k < CACHE_LEVELS) {
+            struct CacheGeometry g = config->level[k];
+            unsigned words, line, ways;
+            char policy[8];
+            int fields = sscanf(value, "%u/%u/%u/%7s", &words, &line, &ways, policy);
+            if (strcmp(value, "off") == 0) {
+                g.words = 0;
+            } else if (fields < 3 || words > ADDRESS_SPACE || line > 0xFFFF || ways > 0xFFFF) {
+                return "expected off or words/line/ways[/policy]";
+            } else {
+                g.words = words;
+                g.line_words = (uint16_t)line;
+                g.ways = (uint16_t)ways;
+                if (fields == 4) {
+                    g.policy = 0;
+                    while (g.policy < CACHE_POLICIES && strcmp(policy, POLICY_NAMES[g.policy]) != 0) {
+                        g.policy++;
+                    }
+                    if (g.policy == CACHE_POLICIES) return "policy must be lru, fifo or random";
+                }
+            }
+            if (!cache_geometry_ok(&g)) return "lines must be a power of two filling whole sets";
+            config->level[k] = g;
+        } else if (strcmp(item, "l2cycles") == 0) {
+            config->l2_cycles = (uint16_t)strtoul(value, NULL, 0);
+        } else if (strcmp(item, "memory") == 0) {
+            config->memory_cycles = (uint16_t)strtoul(value, NULL, 0);
+        } else {
+            return "unknown setting (l1i, l1d, l2, l2cycles or memory)";
+        }
+    }
+    return NULL;
+}
+
+// Look address up in l, filling its line on a miss; returns 1 on a hit
+static int cache_lookup(struct Cache *c, struct CacheLevel *l, word_t address, int region) {
+    const struct CacheGeometry *g = &l->geometry;
+    uint32_t block = address / g->line_words;
+    uint32_t tag = block / l->sets;
+    struct CacheLine *set = &l->line[(size_t)(block % l->sets) * g->ways];
+    struct CacheLine *victim = NULL;
+
+    c->clock++;
+    for (int w = 0; w < g->ways; w++) {
+        if (set[w].valid && set[w].tag == tag) {
+            if (g->policy == CACHE_LRU) set[w].stamp = c->clock;
+            l->hits[region]++;
+            return 1;
+        }
+        if (!set[w].valid && victim == NULL) victim = &set[w];
+    }
 
+    l->misses[region]++;
+    if (victim == NULL) {
+        if (g->policy == CACHE_RANDOM) {
+            c->seed ^= c->seed << 13;   // xorshift32
+            c->seed ^= c->seed >> 17;
+            c->seed ^= c->seed << 5;
+            victim = &set[c->seed % g->ways];
+        } else {
+            victim = &set[0];
+            for (int w = 1; w < g->ways; w++) {
+                if (set[w].stamp < victim->stamp) victim = &set[w];
+            }
+        }
+        l->evictions[victim->region]++;
+    }
+    victim->tag = tag;
+    victim->valid = 1;
+    victim->region = (uint8_t)region;
+    victim->stamp = c->clock;
     return 0;
 }
+
+// Cycles an access through L1 level l1 waits beyond a hit
+static uint64_t cache_access(struct Cache *c, int l1, word_t address, int region) {
+    struct CacheLevel *l2 = &c->level[CACHE_L2];
+    uint64_t cycles;
+
+    if (c->level[l1].geometry.words && cache_lookup(c, &c->level[l1], address, region)) return 0;
+    if (l2->geometry.words == 0) {
+        cycles = c->config.memory_cycles;
+    } else {
+        cycles = c->config.l2_cycles +
+                 (cache_lookup(c, l2, address, region) ? 0 : c->config.memory_cycles);
+    }
+    c->penalty[region] += cycles;
+    return cycles;
+}
+
+// LOAD and STORE above SP, up to the top of the stack, reach into stack frames
+static int data_region(const struct CPU *cpu, word_t address) {
+    return address > cpu->spr.SP && address < CODE_SIZE ? REGION_STACK : REGION_DATA;
+}
+
+// Memory access of the executing LOAD, STORE, CALL or RET
+static void cache_data(struct CPU *cpu, word_t address, int region) {
+    cpu->cache->data_penalty += cache_access(cpu->cache, CACHE_L1D, address, region);
+}
+
+// Fetch of instruction w from ip, all of its words
+static void cache_fetch(struct CPU *cpu, word_t ip, word_t w) {
+    struct Cache *c = cpu->cache;
+    for (int k = 0; k < INSTR_WORDS(w); k++) {
+        c->fetch_penalty += cache_access(c, CACHE_L1I, (word_t)(ip + k), REGION_CODE);
+    }
+    if ((w >> 12) == HALT && c->report) cache_report(cpu, c->report);
+}
+
+void cache_report(const struct CPU *cpu, FILE *out) {
+    const struct Cache *c = cpu->cache;
+    uint64_t total = 0;
+
+    if (c == NULL) return;
+    for (int r = 0; r < REGION_COUNT; r++) total += c->penalty[r];
+
+    fprintf(out, "Caches: L2 hit %d cycles, memory %d cycles\n",
+            c->config.l2_cycles, c->config.memory_cycles);
+    for (int k = 0; k < CACHE_LEVELS; k++) {
+        const struct CacheLevel *l = &c->level[k];
+        const struct CacheGeometry *g = &l->geometry;
+        if (g->words == 0) continue;
+        fprintf(out, "  %-3s %u words, %d-word lines, %d-way, %s\n", CACHE_NAMES[k], g->words,
+                g->line_words, g->ways, POLICY_NAMES[g->policy]);
+        for (int r = 0; r < REGION_COUNT; r++) {
+            uint64_t n = l->hits[r] + l->misses[r];
+            if (n == 0 && l->evictions[r] == 0) continue;
+            fprintf(out, "    %-6s %12llu hits %10llu misses %10llu evictions %7.2f%%\n",
+                    REGION_NAMES[r], (unsigned long long)l->hits[r],
+                    (unsigned long long)l->misses[r], (unsigned long long)l->evictions[r],
+                    n ? 100.0 * l->hits[r] / n : 0);
+        }
+    }
+    fprintf(out, "  Miss penalty: %llu cycles (code %llu, data %llu, stack %llu)\n",
+            (unsigned long long)total, (unsigned long long)c->penalty[REGION_CODE],
+            (unsigned long long)c->penalty[REGION_DATA], (unsigned long long)c->penalty[REGION_STACK]);
+}
+
+/* ---------------- Pipeline timing model ---------------- */
+
+#define PIPE_FLAGS 8   // ready[] slots after R0-R7
+#define PIPE_SP    9
+#define PIPE_FILL  4   // cycles before the first instruction reaches WB
+
+static const char *STALL_NAMES[STALL_COUNT] = {
+    "data", "load-use", "multi-cycle", "control", "fetch", "i-cache", "d-cache"
+};
+
+struct Pipeline *pipeline_create(struct PipelineConfig config, FILE *report) {
+    struct Pipeline *p = calloc(1, sizeof(struct Pipeline));
+    if (p == NULL) return NULL;
+    if (config.mul_cycles < 1) config.mul_cycles = 1;
+    if (config.div_cycles < 1) config.div_cycles = 1;
+    p->config = config;
+    p->report = report;
+    return p;
+}
+
+void pipeline_destroy(struct Pipeline *p) {
+    free(p);
+}
+
+// The last instruction leaves WB in the cycle after its MEM stage
+uint64_t pipeline_cycles(const struct Pipeline *p) {
+    return p->instructions ? p->ex_at + p->ex_cycles + p->mem_stall + 2 : 0;
+}
+
+static uint64_t max_u64(uint64_t a, uint64_t b) {
+    return a > b ? a : b;
+}
+
+// ready[] slots instruction w reads and writes, as bit masks
+static void pipeline_operands(word_t w, unsigned *reads, unsigned *writes) {
+    uint8_t op = w >> 12, r1 = (w >> 9) & 0x7, r2 = (w >> 6) & 0x7, rs = w & 0x7;
+    unsigned flags = 1u << PIPE_FLAGS, sp = 1u << PIPE_SP;
+
+    *reads = *writes = 0;
+    switch (op) {
+    case MOV:
+        *reads = IS_REG_FORM(w) ? 1u << rs : 0;
+        *writes = 1u << r1;
+        break;
+    case ADD: case SUB:
+        *reads = 1u << r1 | (IS_REG_FORM(w) ? 1u << rs : 0);
+        *writes = (IS_CMP(w) ? 0 : 1u << r1) | flags;
+        break;
+    case AND: case OR: case MUL: case DIV:
+        *reads = 1u << r1 | 1u << r2;
+        *writes = 1u << r1 | flags;
+        break;
+    case JZ:
+        *reads = BRANCH_COND(w) == COND_DJNZ ? 1u << r1 : flags;
+        *writes = BRANCH_COND(w) == COND_DJNZ ? 1u << r1 | flags : 0;
+        break;
+    case CALL: case RET:
+        *reads = *writes = sp;
+        break;
+    case LOAD:
+        *reads = 1u << r2;
+        *writes = 1u << r1;
+        break;
+    case STORE:
+        *reads = 1u << r1 | 1u << r2;
+        break;
+    case MOVW:
+        *writes = 1u << r1;
+        break;
+    }
+}
+
+static void pipeline_charge(struct Pipeline *p, word_t ip, int cause, uint64_t cycles) {
+    p->stalls[cause] += cycles;
+    if (ip < CODE_SIZE) p->stall_at[ip] += cycles;
+}
+
+// Time instruction w, just executed from ip. The first instruction is
+// fetched in cycle 0; without stalls each one enters EX a cycle after the
+// one before it.
+static void pipeline_issue(struct CPU *cpu, word_t ip, word_t w) {
+    struct Pipeline *p = cpu->pipeline;
+    const struct PipelineConfig *c = &p->config;
+    uint8_t op = w >> 12, r1 = (w >> 9) & 0x7;
+    unsigned reads, writes;
+
+    pipeline_operands(w, &reads, &writes);
+    uint64_t cycles = op == MUL ? c->mul_cycles : op == DIV ? c->div_cycles : 1;
+
+    // Cache misses of this instruction's fetch and of its memory access
+    uint64_t fetch_wait = cpu->cache ? cpu->cache->fetch_penalty : 0;
+    uint64_t mem_wait = cpu->cache ? cpu->cache->data_penalty : 0;
+
+    // IF waits for a refetch and for the previous instruction to move on to
+    // ID; ID takes one cycle per instruction word
+    uint64_t earliest = p->instructions ? p->ex_at + p->ex_cycles + p->mem_stall : 2;
+    uint64_t if_at = p->instructions ? max_u64(p->fetch_at, p->id_at) : 0;
+    uint64_t id_at = max_u64(if_at + INSTR_WORDS(w) + fetch_wait, p->ex_at);
+    uint64_t refetched = max_u64(if_at + 2, earliest);
+    uint64_t cached = max_u64(if_at + 2 + fetch_wait, earliest);
+    uint64_t decoded = max_u64(id_at + 1, earliest);
+
+    // Operands: a STORE's value is only needed by MEM, a cycle after EX
+    uint64_t operands = 0;
+    int from_load = 0;
+    for (int r = 0; r < 10; r++) {
+        if (!(reads & (1u << r)) || p->ready[r] == 0) continue;
+        uint64_t need = p->ready[r];
+        if (op == STORE && r == r1 && c->forwarding && r1 != ((w >> 6) & 0x7)) need--;
+        if (need > operands) {
+            operands = need;
+            from_load = p->loaded[r];
+        }
+    }
+    uint64_t ex_at = max_u64(decoded, operands);
+
+    if (refetched > earliest) pipeline_charge(p, p->refetch_site, STALL_CONTROL, refetched - earliest);
+    if (cached > refetched) pipeline_charge(p, ip, STALL_ICACHE, cached - refetched);
+    if (decoded > cached) pipeline_charge(p, ip, STALL_FETCH, decoded - cached);
+    if (ex_at > decoded) pipeline_charge(p, ip, from_load ? STALL_LOAD_USE : STALL_DATA, ex_at - decoded);
+    if (cycles > 1) pipeline_charge(p, ip, STALL_MULTICYCLE, cycles - 1);
+    if (mem_wait) pipeline_charge(p, ip, STALL_DCACHE, mem_wait);
+
+    // Forwarded results reach EX from the end of EX, or of MEM for a LOAD;
+    // otherwise ID reads them in the cycle WB writes them
+    uint64_t mem_at = ex_at + cycles;
+    uint64_t ready = !c->forwarding ? mem_at + mem_wait + 2 :
+                     op == LOAD ? mem_at + mem_wait + 1 : mem_at;
+    for (int r = 0; r < 10; r++) {
+        if (!(writes & (1u << r))) continue;
+        p->ready[r] = ready;
+        p->loaded[r] = op == LOAD;
+    }
+
+    // JMP and CALL targets are known in ID, a branch resolves in EX and RET
+    // reads its target in MEM; whatever was fetched meanwhile is dropped.
+    // Unpredicted, that is the fall-through after every transfer.
+    int missed = cpu->predictor ? cpu->predictor->last == 0
+               : op != JZ || cond_holds(&cpu->cu.aluflags, BRANCH_COND(w));
+    p->fetch_at = 0;
+    if ((op == JMP || op == CALL) && missed) {
+        p->fetch_at = id_at + 1;
+        p->jumps++;
+    } else if (op == RET && missed) {
+        p->fetch_at = mem_at + mem_wait + 1;
+        p->returns++;
+    } else if (op == JZ && missed) {
+        p->fetch_at = ex_at + 1;
+        p->branches++;
+    }
+    p->refetch_site = ip;
+
+    p->if_at = if_at;
+    p->id_at = id_at;
+    p->ex_at = ex_at;
+    p->ex_cycles = cycles;
+    p->mem_stall = mem_wait;
+    p->instructions++;
+    if (op == HALT && p->report) pipeline_report(cpu, p->report);
+}
+
+void pipeline_report(const struct CPU *cpu, FILE *out) {
+    const struct Pipeline *p = cpu->pipeline;
+    struct ProfileEntry e[CODE_SIZE];
+    uint64_t stalled = 0;
+
+    if (p == NULL) return;
+    for (int k = 0; k < STALL_COUNT; k++) stalled += p->stalls[k];
+    uint64_t cycles = pipeline_cycles(p);
+    double pct = cycles ? 100.0 / cycles : 0;
+
+    fprintf(out, "Pipeline: %llu instructions in %llu cycles, CPI %.3f\n",
+            (unsigned long long)p->instructions, (unsigned long long)cycles,
+            p->instructions ? (double)cycles / p->instructions : 0);
+    fprintf(out, "  IF/ID/EX/MEM/WB, forwarding %s, MUL %d and DIV %d cycles in EX\n",
+            p->config.forwarding ? "on" : "off", p->config.mul_cycles, p->config.div_cycles);
+    fprintf(out, "  Fill            %12d %6.2f%%\n", p->instructions ? PIPE_FILL : 0,
+            p->instructions ? PIPE_FILL * pct : 0);
+    fprintf(out, "  Stalls          %12llu %6.2f%%\n", (unsigned long long)stalled, stalled * pct);
+    for (int k = 0; k < STALL_COUNT; k++) {
+        fprintf(out, "    %-13s %12llu %6.2f%%\n", STALL_NAMES[k],
+                (unsigned long long)p->stalls[k], p->stalls[k] * pct);
+    }
+    fprintf(out, "  Refetches: %llu branches (2 cycles each), %llu JMP/CALL (1), "
+                 "%llu RET (3)\n", (unsigned long long)p->branches,
+            (unsigned long long)p->jumps, (unsigned long long)p->returns);
+
+    // Control stalls are charged to the transfer, the others to the stalled instruction
+    int n = profile_sort(p->stall_at, CODE_SIZE, e);
+    if (n) fprintf(out, "  Stall sites (top %d of %d):\n", n < PROFILE_TOP ? n : PROFILE_TOP, n);
+    for (int i = 0; i < n && i < PROFILE_TOP; i++) {
+        fprintf(out, "    IP=%3d %-5s %12llu %6.2f%%\n", e[i].key,
+                instr_name(cpu_peek(cpu, e[i].key)),
+                (unsigned long long)e[i].count, e[i].count * pct);
+    }
+}
+
+// Whether a model needs to see every instruction, which rules out fusion
+// and the JIT
+static int timing_models(const struct CPU *cpu) {
+    return cpu->pipeline != NULL || cpu->predictor != NULL || cpu->cache != NULL;
+}
+
+// Report instruction w, just executed from ip, to the attached models. Its
+// memory access, if any, already went through the cache as it executed.
+static void timing_retire(struct CPU *cpu, word_t ip, word_t w) {
+    if (cpu->cache) cache_fetch(cpu, ip, w);
+    if (cpu->predictor) predictor_update(cpu, ip, w);
+    if (cpu->pipeline) pipeline_issue(cpu, ip, w);
+    if (cpu->cache) cpu->cache->fetch_penalty = cpu->cache->data_penalty = 0;
+}
+
+/* ---------------- Console output device ---------------- */
+
+// Select the sink and buffer size; buffer_size 1 writes every character through
+void console_open(struct Console *con, uint8_t sink, FILE *file, size_t buffer_size) {
+    con->sink  = sink;
+    con->file  = file;
+    con->limit = buffer_size;
+    con->len   = 0;
+}
+
+void console_flush(struct Console *con) {
+    if (con->len == 0) return;
+
+    if (con->sink == CONSOLE_CAPTURE) {
+        if (con->capture_len + con->len + 1 > con->capture_cap) {
+            size_t cap = con->capture_cap ? con->capture_cap : CONSOLE_BUF_SIZE;
+            while (cap < con->capture_len + con->len + 1) cap *= 2;
+            char *grown = realloc(con->capture, cap);
+            if (grown == NULL) {
+                con->len = 0;   // out of memory: drop the text, keep running
+                return;
+            }
+            con->capture = grown;
+            con->capture_cap = cap;
+        }
+        memcpy(con->capture + con->capture_len, con->buf, con->len);
+        con->capture_len += con->len;
+        con->capture[con->capture_len] = '\0';
+    } else {
+        FILE *out = (con->sink == CONSOLE_FILE && con->file) ? con->file : stdout;
+        fwrite(con->buf, 1, con->len, out);
+        fflush(out);
+    }
+    con->len = 0;
+}
+
+void console_putc(struct Console *con, char c) {
+    size_t limit = (con->limit == 0 || con->limit > CONSOLE_BUF_SIZE)
+                   ? CONSOLE_BUF_SIZE : con->limit;
+
+    con->buf[con->len++] = c;
+    if (c == '\n' || con->len >= limit) {
+        console_flush(con);
+    }
+}
+
+// Flush and free the capture text (the FILE stays owned by the caller)
+void console_close(struct Console *con) {
+    console_flush(con);
+    free(con->capture);
+    con->capture = NULL;
+    con->capture_len = con->capture_cap = 0;
+}
+
+/* ---------------- Paged memory ---------------- */
+
+#define PAGE_MASK (PAGE_WORDS - 1)
+
+// Backs every page that has never been written; never modified
+static word_t ZERO_PAGE[PAGE_WORDS];
+
+static void cpu_fault(struct CPU *cpu, const char *reason);
+
+static word_t memory_read(const struct CPU *cpu, word_t address) {
+    return cpu->mainMemory.page[address >> PAGE_SHIFT][address & PAGE_MASK];
+}
+
+// Give the CPU a private copy of page p before its first write to it
+static word_t *memory_own_page(struct Memory *m, unsigned p) {
+    word_t *page = malloc(PAGE_WORDS * sizeof(word_t));
+    if (page == NULL) return NULL;
+    memcpy(page, m->page[p] ? m->page[p] : ZERO_PAGE, PAGE_WORDS * sizeof(word_t));
+    m->page[p] = page;
+    m->owned[p] = 1;
+    return page;
+}
+
+// Plain store: no MMIO, no decode invalidation
+static void memory_store(struct CPU *cpu, word_t address, word_t value) {
+    struct Memory *m = &cpu->mainMemory;
+    unsigned p = address >> PAGE_SHIFT;
+
+    if (!m->owned[p]) {
+        if (value == 0 && (m->page[p] == ZERO_PAGE || m->page[p] == NULL)) {
+            m->page[p] = ZERO_PAGE;   // still all zero: stay unmapped
+            return;
+        }
+        if (memory_own_page(m, p) == NULL) {
+            cpu_fault(cpu, "Out of memory!");
+            return;
+        }
+    }
+    m->page[p][address & PAGE_MASK] = value;
+}
+
+// Free owned pages and leave every page unmapped
+static void memory_clear(struct Memory *m) {
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        if (m->owned[p]) free(m->page[p]);
+        m->page[p] = ZERO_PAGE;
+        m->owned[p] = 0;
+    }
+}
+
+/* ---------------- Memory-Mapped I/O ---------------- */
+
+static void jit_flush(struct JIT *j);
+static void jit_invalidate(struct CPU *cpu, word_t address);
+
+// Drop the cached decode (and any compiled code) of a word about to change,
+// along with fused entries that start up to FUSE_MAX - 1 words earlier
+static void invalidate_decoded(struct CPU *cpu, word_t address) {
+    if (address < CODE_SIZE) {
+        for (int k = 0; k < FUSE_MAX && k <= address; k++) {
+            cpu->decoded.entry[address - k].exec = NULL;
+        }
+        jit_invalidate(cpu, address);
+    }
+}
+
+static void memory_write(struct CPU *cpu, word_t address, word_t value) {
+    // Check for memory-mapped I/O
+    if (address == MMIO_CHAR_OUT) {
+        // Character output port
+        console_putc(&cpu->console, (char)(value & 0xFF));
+    } else if (address == MMIO_FLUSH) {
+        console_flush(&cpu->console);
+    }
+    
+    // Always write to memory as well
+    invalidate_decoded(cpu, address);
+    memory_store(cpu, address, value);
+}
+
+/* ---------------- CPU core helpers ---------------- */
+
+/* ---------------- Reset & program loading ---------------- */
+
+void cpu_reset(struct CPU *cpu) {
+    console_flush(&cpu->console);
+    memory_clear(&cpu->mainMemory);
+    memset(&cpu->gpr, 0, sizeof(cpu->gpr));
+    memset(&cpu->cu, 0, sizeof(cpu->cu));
+    memset(&cpu->alu, 0, sizeof(cpu->alu));
+    memset(&cpu->decoded, 0, sizeof(cpu->decoded));
+    cpu->trace.count = 0;
+    if (cpu->jit) jit_flush(cpu->jit);
+    cpu->spr.SP = 399;   // top of stack
+    cpu->fault = NULL;
+    cpu->static_counter = 0;
+    cpu->running = 1;
+}
+
+// A zeroed CPU has no page table yet: map everything to the zero page
+static void memory_init(struct Memory *m) {
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        if (m->page[p] == NULL) m->page[p] = ZERO_PAGE;
+    }
+}
+
+// Start a freshly loaded program at ip
+static void cpu_start(struct CPU *cpu, word_t ip) {
+    memset(&cpu->decoded, 0, sizeof(cpu->decoded));
+    if (cpu->jit) jit_flush(cpu->jit);
+    cpu->cu.IP = ip;
+    cpu->spr.SP = 399;   // top of stack
+    cpu->fault = NULL;
+    cpu->running = 1;
+}
+
+void cpu_load_program(struct CPU *cpu, const word_t *program, size_t size, word_t start_ip) {
+    memory_init(&cpu->mainMemory);
+    for (size_t i = 0; i < size && start_ip + i < ADDRESS_SPACE; i++) {
+        memory_store(cpu, (word_t)(start_ip + i), program[i]);
+    }
+    cpu_start(cpu, start_ip);
+}
+
+// Whole pages point into program and are never written through: like
+// pages taken over from a snapshot, they are unowned and copied on the
+// first store. Only the partial pages at either end are copied now.
+void cpu_map_program(struct CPU *cpu, const word_t *program, size_t size,
+                     word_t load, word_t entry) {
+    struct Memory *m = &cpu->mainMemory;
+    size_t end = load + size < ADDRESS_SPACE ? load + size : ADDRESS_SPACE;
+
+    memory_init(m);
+    for (size_t a = load; a < end; ) {
+        unsigned p = (unsigned)(a >> PAGE_SHIFT);
+        if ((a & PAGE_MASK) == 0 && a + PAGE_WORDS <= end) {
+            if (m->owned[p]) free(m->page[p]);
+            m->page[p] = (word_t *)(program + (a - load));
+            m->owned[p] = 0;
+            a += PAGE_WORDS;
+        } else {
+            memory_store(cpu, (word_t)a, program[a - load]);
+            a++;
+        }
+    }
+    cpu_start(cpu, entry);
+}
+
+void cpu_release(struct CPU *cpu) {
+    memory_clear(&cpu->mainMemory);
+}
+
+// Stop the CPU with an error; the driver reports cpu->fault
+static void cpu_fault(struct CPU *cpu, const char *reason) {
+    cpu->fault = reason;
+    cpu->running = 0;
+    console_flush(&cpu->console);
+}
+
+/* ---------------- Snapshots ---------------- */
+
+// The snapshot keeps the owned[] flags of the pages it took over; the CPUs
+// on either side see them as shared and copy before writing.
+void cpu_snapshot(struct CPU *cpu, struct CPUSnapshot *snap) {
+    console_flush(&cpu->console);
+    memcpy(snap->state, cpu, sizeof(snap->state));
+    memset(cpu->mainMemory.owned, 0, sizeof(cpu->mainMemory.owned));
+}
+
+void cpu_restore(struct CPU *cpu, const struct CPUSnapshot *snap) {
+    console_flush(&cpu->console);
+    memory_clear(&cpu->mainMemory);
+    memcpy(cpu, snap->state, sizeof(snap->state));
+    memset(cpu->mainMemory.owned, 0, sizeof(cpu->mainMemory.owned));
+    if (cpu->jit) jit_flush(cpu->jit);   // compiled code belongs to the old memory
+}
+
+void cpu_snapshot_free(struct CPUSnapshot *snap) {
+    struct Memory m;
+    memcpy(&m, snap->state + offsetof(struct CPU, mainMemory), sizeof(m));
+    memory_clear(&m);
+    memcpy(snap->state + offsetof(struct CPU, mainMemory), &m, sizeof(m));
+}
+
+void cpu_fork(const struct CPUSnapshot *snap, struct CPU *clones, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        cpu_restore(&clones[i], snap);
+    }
+}
+
+void cpu_poke(struct CPU *cpu, word_t address, word_t value) {
+    invalidate_decoded(cpu, address);
+    memory_store(cpu, address, value);
+}
+
+word_t cpu_peek(const struct CPU *cpu, word_t address) {
+    const word_t *page = cpu->mainMemory.page[address >> PAGE_SHIFT];
+    return page ? page[address & PAGE_MASK] : 0;
+}
+
+int cpu_page_mapped(const struct CPU *cpu, unsigned page) {
+    const word_t *words = cpu->mainMemory.page[page];
+    return words != NULL && words != ZERO_PAGE;
+}
+
+static uint64_t hash_words(uint64_t h, const word_t *w, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ w[i]) * 0x100000001B3ull;   // FNV-1a
+    }
+    return h;
+}
+
+// Pages are skipped while all zero, so how a page is backed (owned, shared
+// with a snapshot or image, or never written) does not change the hash
+uint64_t cpu_state_hash(const struct CPU *cpu) {
+    word_t state[14] = {
+        cpu->cu.IP, cpu->spr.SP, cpu->static_counter, (word_t)cpu->running,
+        cpu->fault != NULL, pack_flags(&cpu->cu.aluflags)
+    };
+    memcpy(&state[6], cpu->gpr.reg, sizeof(cpu->gpr.reg));
+    uint64_t h = hash_words(0xCBF29CE484222325ull, state, sizeof(state) / sizeof(state[0]));
+
+    for (unsigned p = 0; p < PAGE_COUNT; p++) {
+        const word_t *page = cpu->mainMemory.page[p];
+        if (page == NULL || page == ZERO_PAGE) continue;
+
+        unsigned i = 0;
+        while (i < PAGE_WORDS && page[i] == 0) i++;
+        if (i == PAGE_WORDS) continue;
+        word_t index = (word_t)p;
+        h = hash_words(hash_words(h, &index, 1), page, PAGE_WORDS);
+    }
+    return h;
+}
+
+/* ---------------- ALU dispatch ---------------- */
+
+// Run ALU operation d on (x, y) and latch the flags into the CU.
+// The fast path never touches struct ALU; the reference path drives
+// the full x/y/control-word datapath like the hardware would.
+static word_t alu_exec(struct CPU *cpu, uint8_t d, word_t x, word_t y) {
+    if (cpu->alu_mode == ALU_REFERENCE) {
+        cpu->alu.x = x;
+        cpu->alu.y = y;
+        alu_set_control(&cpu->alu.flags, d);
+        alu_compute(&cpu->alu);
+        cpu->cu.aluflags = cpu->alu.flags;
+        return cpu->alu.out;
+    }
+
+    struct ALUFlags *f = &cpu->cu.aluflags;
+    alu_fn op = ALU_FAST_OPS[d & 0x3F];
+    word_t out = 0;
+
+    alu_set_control(f, d);
+    f->cy = 0;
+    f->ov = 0;
+    if (op) {
+        out = op(x, y, f);
+    }
+    f->zr = (out == 0);
+    f->ng = (out >> (WORD_SIZE - 1)) & 1u;
+    return out;
+}
+
+/* ---------------- Instruction handlers ---------------- */
+
+// Every handler returns to the run_cpu loop; CALL and RET are plain
+// control transfers through the guest stack, never host recursion.
+
+static void exec_nop(struct CPU *cpu, const struct DecodedInstr *di) {
+    (void)cpu;
+    (void)di;
+}
+
+static void exec_mov(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = di->imm;
+}
+
+// MOVW R1 - Load the 16-bit word after the instruction into R1
+static void exec_movw(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->cu.IP >= CODE_SIZE) {
+        cpu_fault(cpu, "Instruction fetch out of bounds!");
+        return;
+    }
+    cpu->gpr.reg[di->r1] = di->wide;
+    cpu->cu.IP++;
+}
+
+static void exec_add(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_ADD, cpu->gpr.reg[di->r1], di->imm);
+}
+
+static void exec_sub(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1], di->imm);
+}
+
+// Register forms: decode moves the source register into r2
+static void exec_mov_reg(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = cpu->gpr.reg[di->r2];
+}
+
+static void exec_add_reg(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_ADD, cpu->gpr.reg[di->r1],
+                                    cpu->gpr.reg[di->r2]);
+}
+
+static void exec_sub_reg(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1],
+                                    cpu->gpr.reg[di->r2]);
+}
+
+// CMP R1, IMM / CMP R1, Rs - the flags of SUB without its result
+static void exec_cmp(struct CPU *cpu, const struct DecodedInstr *di) {
+    alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1], di->imm);
+}
+
+static void exec_cmp_reg(struct CPU *cpu, const struct DecodedInstr *di) {
+    alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1], cpu->gpr.reg[di->r2]);
+}
+
+static void exec_and(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_AND, cpu->gpr.reg[di->r1],
+                                    cpu->gpr.reg[di->r2]);
+}
+
+static void exec_or(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_OR, cpu->gpr.reg[di->r1],
+                                    cpu->gpr.reg[di->r2]);
+}
+
+static void exec_mul(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_MUL, cpu->gpr.reg[di->r1],
+                                    cpu->gpr.reg[di->r2]);
+}
+
+static void exec_div(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->gpr.reg[di->r2] == 0) {
+        cpu_fault(cpu, "Division by zero!");
+        return;
+    }
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_DIV, cpu->gpr.reg[di->r1],
+                                    cpu->gpr.reg[di->r2]);
+}
+
+static void exec_jmp(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->cu.IP = di->imm;
+}
+
+static void exec_jz(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->cu.aluflags.zr) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_jnz(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (!cpu->cu.aluflags.zr) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_jn(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->cu.aluflags.ng) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_jnn(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (!cpu->cu.aluflags.ng) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_jc(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->cu.aluflags.cy) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_jo(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->cu.aluflags.ov) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_jnc(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (!cpu->cu.aluflags.cy) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+// DJNZ R1, IMM - R1 = R1 - 1 (setting the flags like SUB), jump if nonzero
+static void exec_djnz(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1], 1);
+    if (!cpu->cu.aluflags.zr) {
+        cpu->cu.IP = di->imm;
+    }
+}
+
+static void exec_call(struct CPU *cpu, const struct DecodedInstr *di) {
+    if (cpu->spr.SP == 0) {
+        cpu_fault(cpu, "Stack overflow!");
+        return;
+    }
+    if (cpu->cache) cache_data(cpu, cpu->spr.SP, REGION_STACK);
+    invalidate_decoded(cpu, cpu->spr.SP);
+    memory_store(cpu, cpu->spr.SP, cpu->cu.IP);
+    cpu->spr.SP--;
+    cpu->cu.IP = di->imm;
+    cpu->static_counter++;
+}
+
+static void exec_ret(struct CPU *cpu, const struct DecodedInstr *di) {
+    (void)di;
+    if (cpu->spr.SP >= 399) {
+        cpu_fault(cpu, "Stack underflow!");
+        return;
+    }
+    cpu->cu.IP = memory_read(cpu, ++cpu->spr.SP);
+    cpu->static_counter--;
+    if (cpu->cache) cache_data(cpu, cpu->spr.SP, REGION_STACK);
+}
+
+static void exec_halt(struct CPU *cpu, const struct DecodedInstr *di) {
+    (void)di;
+    cpu->running = 0;
+    console_flush(&cpu->console);
+}
+
+static void exec_load(struct CPU *cpu, const struct DecodedInstr *di) {
+    // LOAD R1, R2 - Load from memory[R2] into R1
+    word_t address = cpu->gpr.reg[di->r2];
+    if (cpu->cache) cache_data(cpu, address, data_region(cpu, address));
+    cpu->gpr.reg[di->r1] = memory_read(cpu, address);
+}
+
+static void exec_store(struct CPU *cpu, const struct DecodedInstr *di) {
+    // STORE R1, R2 - Store R1 into memory[R2]
+    word_t address = cpu->gpr.reg[di->r2];
+    if (cpu->cache) cache_data(cpu, address, data_region(cpu, address));
+    memory_write(cpu, address, cpu->gpr.reg[di->r1]);
+}
+
+// Indexed by the 4-bit opcode
+static const exec_fn EXEC_TABLE[16] = {
+    exec_nop,  exec_mov,  exec_add,  exec_sub,
+    exec_and,  exec_or,   exec_mul,  exec_div,
+    exec_jmp,  exec_jz,   exec_call, exec_ret,
+    exec_halt, exec_load, exec_store, exec_movw
+};
+
+// Conditional branches, indexed by COND_*
+static const exec_fn JCC_TABLE[8] = {
+    exec_jz, exec_jnz, exec_jn,  exec_jnn,
+    exec_jc, exec_jo,  exec_jnc, exec_djnz
+};
+
+/* ---------------- Superinstructions ---------------- */
+
+// Each fused handler runs a whole idiom with the architectural effects
+// of its parts: IP ends past (or at the target of) the last word and IR
+// holds that word. fetch_decode_execute has already advanced IP by one.
+
+// MOV r, a ; ADD/SUB r, b  (register load built from two immediates)
+static void exec_fused_mov_alu(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, di->r2 ? ALU_SUB : ALU_ADD,
+                                    di->imm, di->imm2);
+    cpu->cu.IP += 1;
+    cpu->cu.IR = di->last;
+}
+
+// MOV r, a ; ADD r, b ; STORE r, rs  (emit a constant, e.g. to MMIO_CHAR_OUT)
+static void exec_fused_mov_add_store(struct CPU *cpu, const struct DecodedInstr *di) {
+    word_t value = alu_exec(cpu, ALU_ADD, di->imm, di->imm2);
+    cpu->gpr.reg[di->r1] = value;
+    cpu->cu.IP += 2;
+    cpu->cu.IR = di->last;
+    memory_write(cpu, cpu->gpr.reg[di->r2], value);
+}
+
+// MOVW r, k ; STORE r, rs  (emit a wide constant, e.g. a character)
+static void exec_fused_movw_store(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = di->wide;
+    cpu->cu.IP += 2;
+    cpu->cu.IR = di->last;
+    memory_write(cpu, cpu->gpr.reg[di->r2], di->wide);
+}
+
+// Second half of the ALU ; Jcc idioms below
+static inline void fused_branch(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->cu.IP += 1;
+    cpu->cu.IR = di->last;
+    if (cond_holds(&cpu->cu.aluflags, di->cond)) {
+        cpu->cu.IP = di->imm2;
+    }
+}
+
+// ADD/SUB r, k ; Jcc t  (update and branch)
+static void exec_fused_alu_jcc(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, di->op == SUB ? ALU_SUB : ALU_ADD,
+                                    cpu->gpr.reg[di->r1], di->imm);
+    fused_branch(cpu, di);
+}
+
+// ADD/SUB r, rs ; Jcc t
+static void exec_fused_alu_reg_jcc(struct CPU *cpu, const struct DecodedInstr *di) {
+    cpu->gpr.reg[di->r1] = alu_exec(cpu, di->op == SUB ? ALU_SUB : ALU_ADD,
+                                    cpu->gpr.reg[di->r1], cpu->gpr.reg[di->r2]);
+    fused_branch(cpu, di);
+}
+
+// CMP r, k ; Jcc t  (compare-and-branch)
+static void exec_fused_cmp_jcc(struct CPU *cpu, const struct DecodedInstr *di) {
+    alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1], di->imm);
+    fused_branch(cpu, di);
+}
+
+// CMP r, rs ; Jcc t  (compare two registers and branch)
+static void exec_fused_cmp_reg_jcc(struct CPU *cpu, const struct DecodedInstr *di) {
+    alu_exec(cpu, ALU_SUB, cpu->gpr.reg[di->r1], cpu->gpr.reg[di->r2]);
+    fused_branch(cpu, di);
+}
+
+// Recognise an idiom starting at address; fills the fused fields of di
+static void fuse_instruction(const struct CPU *cpu, word_t address,
+                             struct DecodedInstr *di) {
+    if (address + 1 >= CODE_SIZE) return;
+
+    word_t next = memory_read(cpu, address + 1);
+    uint8_t op2  = (next >> 12) & 0xF;
+    uint8_t r1b  = (next >> 9)  & 0x7;
+    uint8_t imm2 = next & 0x3F;
+    int reg_form = IS_REG_FORM(di->last);
+
+    if (di->op == MOV && !reg_form && (op2 == ADD || op2 == SUB) && !IS_REG_FORM(next) &&
+        !IS_CMP(next) && r1b == di->r1) {
+        word_t third = address + 2 < CODE_SIZE ? memory_read(cpu, address + 2) : 0;
+
+        di->imm2 = imm2;
+        if (op2 == ADD && ((third >> 12) & 0xF) == STORE &&
+            ((third >> 9) & 0x7) == di->r1) {
+            di->r2   = (third >> 6) & 0x7;   // address register of the STORE
+            di->last = third;
+            di->len  = 3;
+            di->exec = exec_fused_mov_add_store;
+        } else {
+            di->r2   = (op2 == SUB);         // MOV's r2 is unused: pick ADD/SUB
+            di->last = next;
+            di->len  = 2;
+            di->exec = exec_fused_mov_alu;
+        }
+    } else if ((di->op == ADD || di->op == SUB) && op2 == JZ &&
+               BRANCH_COND(next) != COND_DJNZ) {
+        int cmp = IS_CMP(di->last);
+
+        di->imm2 = imm2;
+        di->cond = BRANCH_COND(next);
+        di->last = next;
+        di->len  = 2;
+        di->exec = cmp ? (reg_form ? exec_fused_cmp_reg_jcc : exec_fused_cmp_jcc)
+                       : (reg_form ? exec_fused_alu_reg_jcc : exec_fused_alu_jcc);
+    } else if (di->op == MOVW && address + 2 < CODE_SIZE) {
+        word_t store = memory_read(cpu, address + 2);   // next is the immediate
+
+        if (((store >> 12) & 0xF) == STORE && ((store >> 9) & 0x7) == di->r1) {
+            di->r2   = (store >> 6) & 0x7;
+            di->last = store;
+            di->len  = 2;
+            di->exec = exec_fused_movw_store;
+        }
+    }
+}
+
+/* ---------------- Fetch / Decode / Execute ---------------- */
+
+// Operands and handler of the single instruction instr
+static void decode_word(word_t instr, struct DecodedInstr *di) {
+    di->op   = (instr >> 12) & 0xF;
+    di->r1   = (instr >> 9)  & 0x7;
+    di->r2   = (instr >> 6)  & 0x7;
+    di->imm  = instr & 0x3F;
+    di->len  = 1;
+    di->last = instr;
+    di->cond = 0;
+    di->exec = EXEC_TABLE[di->op];
+    if (IS_REG_FORM(instr)) {
+        di->r2   = di->imm & 0x7;
+        di->exec = di->op == MOV ? exec_mov_reg : di->op == ADD ? exec_add_reg : exec_sub_reg;
+    }
+    if (IS_CMP(instr)) {
+        di->exec = IS_REG_FORM(instr) ? exec_cmp_reg : exec_cmp;
+    } else if (di->op == JZ) {
+        di->cond = BRANCH_COND(instr);
+        di->exec = JCC_TABLE[di->cond];
+    }
+}
+
+static void decode_instruction(const struct CPU *cpu, word_t address,
+                               struct DecodedInstr *di) {
+    decode_word(memory_read(cpu, address), di);
+    di->wide = address + 1 < CODE_SIZE ? memory_read(cpu, address + 1) : 0;
+    fuse_instruction(cpu, address, di);
+}
+
+// Returns how many guest instructions ran: more than one only for a fused
+// idiom, which needs fuse set and no tracing
+static int fetch_decode_execute(struct CPU *cpu, int fuse) {
+    if (cpu->running == 0) return 0;
+
+    if (cpu->cu.IP >= CODE_SIZE) {
+        cpu_fault(cpu, "Instruction fetch out of bounds!");
+        return 0;
+    }
+
+    word_t ip = cpu->cu.IP++;
+    struct DecodedInstr *di = &cpu->decoded.entry[ip];
+    cpu->cu.IR = memory_read(cpu, ip);
+
+    // Decode each word once; later fetches reuse the cached operands
+    if (di->exec == NULL) {
+        decode_instruction(cpu, ip, di);
+    }
+
+    // Silent fast path: no snapshot, no formatting
+    if (!cpu->trace.enabled && cpu->on_step == NULL) {
+        if ((fuse && !timing_models(cpu)) || di->len == 1) {
+            di->exec(cpu, di);
+            if (cpu->profile) profile_count(cpu, ip, di);
+            timing_retire(cpu, ip, cpu->cu.IR);
+            return di->len;
+        }
+    }
+
+    // One guest instruction only, bypassing fusion
+    struct DecodedInstr single = *di;
+    if (di->len > 1) {
+        decode_word(cpu->cu.IR, &single);
+    }
+    if (!cpu->trace.enabled && cpu->on_step == NULL) {
+        single.exec(cpu, &single);
+        if (cpu->profile) profile_count(cpu, ip, &single);
+        timing_retire(cpu, ip, cpu->cu.IR);
+        return 1;
+    }
+
+    // Narration is printed as it happens, so keep guest output in step with it
+    if (cpu->on_step) {
+        console_flush(&cpu->console);
+    }
+    struct GPR before = cpu->gpr;
+    word_t ir = cpu->cu.IR;
+    single.exec(cpu, &single);
+    if (cpu->profile) profile_count(cpu, ip, &single);
+    timing_retire(cpu, ip, ir);
+    trace_record(cpu, ip, ir, &before);
+    return 1;
+}
+
+/* ---------------- JIT tier (x86-64) ---------------- */
+
+// Basic blocks end at JMP/Jcc (compiled) or just before CALL/RET/HALT/DIV,
+// which are left to the interpreter. Guest R0-R7 live in r8w-r15w while
+// compiled code runs; rdi holds the CPU, rbp the remaining instruction
+// budget and rbx the code map. Blocks chain to each other with direct
+// jumps that are patched in as their targets get compiled.
+
+#define JIT_CODE_SIZE   (1 << 20)   // bytes of executable buffer
+#define JIT_MAX_BLOCK   64          // guest instructions per block
+#define JIT_BLOCK_SLACK (16 * 1024) // free space required before compiling
+
+#if defined(__x86_64__) && !defined(_WIN32)
+
+struct JitPatch {
+    uint32_t site;    // offset of a rel32 that should jump to target's block
+    word_t target;
+};
+
+struct JIT {
+    uint8_t *code;
+    uint32_t size;                       // bytes emitted so far
+    uint32_t base;                       // end of the enter/exit trampolines
+    uint32_t exit;                       // offset of the common exit path
+    uint8_t *block[CODE_SIZE];           // compiled entry for each start address
+    uint8_t interp_only[CODE_SIZE];      // block start the interpreter must run
+    uint8_t code_map[CODE_SIZE];         // words covered by compiled code
+    struct JitPatch *patch;
+    uint32_t patch_count, patch_cap;
+};
+
+typedef int64_t (*jit_enter_fn)(struct CPU *cpu, uint8_t *entry, int64_t budget);
+
+#define CPU_OFF(field) ((uint32_t)offsetof(struct CPU, field))
+
+static void emit8(struct JIT *j, uint8_t b) { j->code[j->size++] = b; }
+
+static void emit16(struct JIT *j, uint16_t v) {
+    emit8(j, (uint8_t)v);
+    emit8(j, (uint8_t)(v >> 8));
+}
+
+static void emit32(struct JIT *j, uint32_t v) {
+    emit16(j, (uint16_t)v);
+    emit16(j, (uint16_t)(v >> 16));
+}
+
+static void emit64(struct JIT *j, uint64_t v) {
+    emit32(j, (uint32_t)v);
+    emit32(j, (uint32_t)(v >> 32));
+}
+
+static void patch_rel32(struct JIT *j, uint32_t site, uint32_t target) {
+    int32_t rel = (int32_t)(target - (site + 4));
+    memcpy(&j->code[site], &rel, sizeof(rel));
+}
+
+// jmp/jcc rel32 whose target is filled in later; returns the rel32 offset
+static uint32_t emit_jmp(struct JIT *j) {
+    emit8(j, 0xE9);
+    emit32(j, 0);
+    return j->size - 4;
+}
+
+static uint32_t emit_jcc(struct JIT *j, uint8_t cc) {
+    emit8(j, 0x0F);
+    emit8(j, (uint8_t)(0x80 | cc));
+    emit32(j, 0);
+    return j->size - 4;
+}
+
+enum { CC_O = 0x0, CC_C = 0x2, CC_AE = 0x3, CC_Z = 0x4, CC_NZ = 0x5,
+       CC_BE = 0x6, CC_S = 0x8, CC_NS = 0x9, CC_L = 0xC };
+
+// Guest branch conditions (COND_Z .. COND_NC) as host condition codes.
+// With stale host flags a branch tests one guest flag instead:
+// COND_FLAG_OFF says which, COND_ON_SET whether it jumps when it is set.
+static const uint8_t COND_HOST_CC[] = { CC_Z, CC_NZ, CC_S, CC_NS, CC_C, CC_O, CC_AE };
+static const uint8_t COND_FLAG_OFF[] = {
+    offsetof(struct ALUFlags, zr), offsetof(struct ALUFlags, zr),
+    offsetof(struct ALUFlags, ng), offsetof(struct ALUFlags, ng),
+    offsetof(struct ALUFlags, cy), offsetof(struct ALUFlags, ov),
+    offsetof(struct ALUFlags, cy)
+};
+static const uint8_t COND_ON_SET[] = { 1, 0, 1, 0, 1, 1, 0 };
+
+// How much of the host EFLAGS mirrors the guest flags
+enum { HOST_FLAGS_NONE, HOST_FLAGS_ZS, HOST_FLAGS_ALL };
+
+// mov word [rdi + off], imm16
+static void emit_store_cpu16(struct JIT *j, uint32_t off, uint16_t imm) {
+    emit8(j, 0x66); emit8(j, 0xC7); emit8(j, 0x87);
+    emit32(j, off);
+    emit16(j, imm);
+}
+
+// setcc byte [rdi + off]
+static void emit_setcc_cpu(struct JIT *j, uint8_t cc, uint32_t off) {
+    emit8(j, 0x0F); emit8(j, (uint8_t)(0x90 | cc)); emit8(j, 0x87);
+    emit32(j, off);
+}
+
+// Latch the control word and the host status flags into cpu->cu.aluflags
+static void emit_flags(struct JIT *j, uint8_t d, int host_cy_ov) {
+    uint32_t f = CPU_OFF(cu.aluflags);
+
+    // zx nx zy ny as one dword, f no as one word; mov leaves EFLAGS alone
+    emit8(j, 0xC7); emit8(j, 0x87);
+    emit32(j, f + offsetof(struct ALUFlags, zx));
+    emit32(j, (uint32_t)((d >> 5) & 1) | (uint32_t)((d >> 4) & 1) << 8 |
+              (uint32_t)((d >> 3) & 1) << 16 | (uint32_t)((d >> 2) & 1) << 24);
+    emit_store_cpu16(j, f + offsetof(struct ALUFlags, f),
+                     (uint16_t)(((d >> 1) & 1) | (d & 1) << 8));
+
+    emit_setcc_cpu(j, CC_Z, f + offsetof(struct ALUFlags, zr));
+    emit_setcc_cpu(j, CC_S, f + offsetof(struct ALUFlags, ng));
+    if (host_cy_ov) {
+        emit_setcc_cpu(j, CC_O, f + offsetof(struct ALUFlags, ov));
+        emit_setcc_cpu(j, CC_C, f + offsetof(struct ALUFlags, cy));
+    }
+}
+
+static void jit_flush(struct JIT *j) {
+    j->size = j->base;
+    j->patch_count = 0;
+    memset(j->block, 0, sizeof(j->block));
+    memset(j->interp_only, 0, sizeof(j->interp_only));
+    memset(j->code_map, 0, sizeof(j->code_map));
+}
+
+static void emit_trampolines(struct JIT *j) {
+    // enter(cpu = rdi, entry = rsi, budget = rdx)
+    emit8(j, 0x53);                                 // push rbx
+    emit8(j, 0x55);                                 // push rbp
+    emit8(j, 0x41); emit8(j, 0x54);                 // push r12
+    emit8(j, 0x41); emit8(j, 0x55);                 // push r13
+    emit8(j, 0x41); emit8(j, 0x56);                 // push r14
+    emit8(j, 0x41); emit8(j, 0x57);                 // push r15
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xD5); // mov rbp, rdx
+    emit8(j, 0x48); emit8(j, 0xBB);                 // mov rbx, code_map
+    emit64(j, (uint64_t)(uintptr_t)j->code_map);
+    for (int r = 0; r < 8; r++) {                   // mov r(8+r)w, gpr.reg[r]
+        emit8(j, 0x66); emit8(j, 0x44); emit8(j, 0x8B);
+        emit8(j, (uint8_t)(0x87 | r << 3));
+        emit32(j, CPU_OFF(gpr.reg) + 2 * r);
+    }
+    emit8(j, 0xFF); emit8(j, 0xE6);                 // jmp rsi
+
+    // Common exit: spill guest registers, return the budget left
+    j->exit = j->size;
+    for (int r = 0; r < 8; r++) {                   // mov gpr.reg[r], r(8+r)w
+        emit8(j, 0x66); emit8(j, 0x44); emit8(j, 0x89);
+        emit8(j, (uint8_t)(0x87 | r << 3));
+        emit32(j, CPU_OFF(gpr.reg) + 2 * r);
+    }
+    emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xE8); // mov rax, rbp
+    emit8(j, 0x41); emit8(j, 0x5F);                 // pop r15
+    emit8(j, 0x41); emit8(j, 0x5E);                 // pop r14
+    emit8(j, 0x41); emit8(j, 0x5D);                 // pop r13
+    emit8(j, 0x41); emit8(j, 0x5C);                 // pop r12
+    emit8(j, 0x5D);                                 // pop rbp
+    emit8(j, 0x5B);                                 // pop rbx
+    emit8(j, 0xC3);                                 // ret
+
+    j->base = j->size;
+}
+
+struct JIT *jit_create(void) {
+    struct JIT *j = calloc(1, sizeof(*j));
+    if (!j) return NULL;
+
+    void *mem = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free(j);
+        return NULL;
+    }
+    j->code = mem;
+    emit_trampolines(j);
+    return j;
+}
+
+void jit_destroy(struct JIT *j) {
+    if (!j) return;
+    munmap(j->code, JIT_CODE_SIZE);
+    free(j->patch);
+    free(j);
+}
+
+static void add_patch(struct JIT *j, uint32_t site, word_t target) {
+    if (j->patch_count == j->patch_cap) {
+        uint32_t cap = j->patch_cap ? j->patch_cap * 2 : 64;
+        struct JitPatch *p = realloc(j->patch, cap * sizeof(*p));
+        if (!p) return;   // site keeps exiting through its stub
+        j->patch = p;
+        j->patch_cap = cap;
+    }
+    j->patch[j->patch_count++] = (struct JitPatch){ site, target };
+}
+
+// Pending exit from a block: set IP (and IR) and leave compiled code
+_Static_assert(PAGE_SHIFT == 8, "emit_page_lookup takes the page offset from al");
+
+// Guest address in eax -> page base in rcx, offset within the page in eax
+static void emit_page_lookup(struct JIT *j) {
+    emit8(j, 0x89); emit8(j, 0xC1);                                 // mov ecx, eax
+    emit8(j, 0xC1); emit8(j, 0xE9); emit8(j, PAGE_SHIFT);           // shr ecx, PAGE_SHIFT
+    emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x8C); emit8(j, 0xCF); // mov rcx, page[rcx]
+    emit32(j, CPU_OFF(mainMemory.page));
+    emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xC0);                 // movzx eax, al
+}
+
+struct JitExit {
+    uint32_t site;      // rel32 to point at the stub
+    word_t ip;
+    word_t ir;
+    uint8_t write_ir;
+    uint32_t refund;    // budget charged for instructions not executed
+};
+
+// Transfer to guest address target: straight into its block when
+// compiled, otherwise through a stub that a later compile patches
+static void emit_chain(struct JIT *j, word_t target,
+                       struct JitExit *exits, int *n_exits) {
+    uint32_t site = emit_jmp(j);
+
+    if (target < CODE_SIZE && j->block[target]) {
+        patch_rel32(j, site, (uint32_t)(j->block[target] - j->code));
+        return;
+    }
+    if (target < CODE_SIZE) {
+        add_patch(j, site, target);
+    }
+    exits[(*n_exits)++] = (struct JitExit){ site, target, 0, 0, 0 };
+}
+
+static int jit_ends_before(uint8_t op) {
+    return op == CALL || op == RET || op == HALT || op == DIV;
+}
+
+static int jit_sets_flags(uint8_t op) {
+    return op == ADD || op == SUB || op == AND || op == OR || op == MUL;
+}
+
+// Compile the block starting at start; returns its entry or NULL
+static uint8_t *jit_compile(struct JIT *j, struct CPU *cpu, word_t start) {
+    word_t words[JIT_MAX_BLOCK];
+    word_t addr[JIT_MAX_BLOCK];          // guest address of each instruction
+    word_t wide[JIT_MAX_BLOCK];          // MOVW immediates
+    uint8_t need_flags[JIT_MAX_BLOCK];
+    struct JitExit exits[3 * JIT_MAX_BLOCK + 4];   // up to three side exits per STORE
+    int n_exits = 0;
+    int n = 0;
+    word_t end = start;   // first word past the block
+
+    // Discover the block; a MOVW whose immediate lies outside the code
+    // window faults, which the interpreter reports
+    while (n < JIT_MAX_BLOCK && end < CODE_SIZE) {
+        word_t w = memory_read(cpu, end);
+        uint8_t op = (w >> 12) & 0xF;
+        if (jit_ends_before(op)) break;
+        if (op == MOVW) {
+            if (end + 1 >= CODE_SIZE) break;
+            wide[n] = memory_read(cpu, (word_t)(end + 1));
+        }
+        addr[n] = end;
+        words[n++] = w;
+        end = (word_t)(end + INSTR_WORDS(w));
+        if (op == JMP || op == JZ) break;
+    }
+
+    if (n == 0) {
+        j->interp_only[start] = 1;
+        j->code_map[start] = 1;
+        return NULL;
+    }
+
+    if (JIT_CODE_SIZE - j->size < JIT_BLOCK_SLACK) {
+        jit_flush(j);
+    }
+
+    // Flags are live at a conditional branch, at STORE (it may exit early)
+    // and at block end; any earlier flag-setting instruction skips
+    // materializing them. DJNZ sets the flags it tests.
+    int live = 1;
+    for (int k = n - 1; k >= 0; k--) {
+        uint8_t op = (words[k] >> 12) & 0xF;
+        int djnz = op == JZ && BRANCH_COND(words[k]) == COND_DJNZ;
+        need_flags[k] = 0;
+        if (jit_sets_flags(op) || djnz) {
+            need_flags[k] = (uint8_t)live;
+            live = 0;
+        }
+        if ((op == JZ && !djnz) || op == STORE) live = 1;
+    }
+
+    uint8_t *entry = j->code + j->size;
+    int host_flags = HOST_FLAGS_NONE;
+
+    // Budget check: leave before running any of the block if it can't finish
+    emit8(j, 0x48); emit8(j, 0x81); emit8(j, 0xFD); emit32(j, (uint32_t)n);
+    exits[n_exits++] = (struct JitExit){ emit_jcc(j, CC_L), start, 0, 0, 0 };
+    emit8(j, 0x48); emit8(j, 0x81); emit8(j, 0xED); emit32(j, (uint32_t)n);
+
+    for (int k = 0; k < n; k++) {
+        word_t w = words[k];
+        uint8_t op  = (w >> 12) & 0xF;
+        uint8_t r1  = (w >> 9)  & 0x7;
+        uint8_t r2  = (w >> 6)  & 0x7;
+        uint8_t imm = w & 0x3F;
+
+        if (IS_REG_FORM(w)) {
+            // mov/add/sub/cmp r(8+r1)w, r(8+rs)w
+            uint8_t rs = imm & 0x7;
+            emit8(j, 0x66); emit8(j, 0x45);
+            emit8(j, op == MOV ? 0x89 : op == ADD ? 0x01 : IS_CMP(w) ? 0x39 : 0x29);
+            emit8(j, (uint8_t)(0xC0 | rs << 3 | r1));
+            if (op != MOV) {
+                if (need_flags[k]) emit_flags(j, op == ADD ? ALU_ADD : ALU_SUB, 1);
+                host_flags = HOST_FLAGS_ALL;
+            }
+        } else if (op == MOV || op == MOVW) {
+            emit8(j, 0x66); emit8(j, 0x41); emit8(j, (uint8_t)(0xB8 | r1));
+            emit16(j, op == MOVW ? wide[k] : imm);
+        } else if (op == ADD || op == SUB) {
+            // add/sub/cmp r(8+r1)w, imm8
+            emit8(j, 0x66); emit8(j, 0x41); emit8(j, 0x83);
+            emit8(j, (uint8_t)((op == ADD ? 0xC0 : IS_CMP(w) ? 0xF8 : 0xE8) | r1));
+            emit8(j, imm);
+            if (need_flags[k]) emit_flags(j, op == ADD ? ALU_ADD : ALU_SUB, 1);
+            host_flags = HOST_FLAGS_ALL;
+        } else if (op == AND || op == OR) {
+            emit8(j, 0x66); emit8(j, 0x45); emit8(j, op == AND ? 0x21 : 0x09);
+            emit8(j, (uint8_t)(0xC0 | r2 << 3 | r1));
+            if (need_flags[k]) emit_flags(j, op == AND ? ALU_AND : ALU_OR, 1);
+            host_flags = HOST_FLAGS_ALL;
+        } else if (op == MUL) {
+            emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, (uint8_t)(0xC0 | r1));
+            emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, (uint8_t)(0xC8 | r2));
+            emit8(j, 0x0F); emit8(j, 0xAF); emit8(j, 0xC1);                 // imul eax, ecx
+            emit8(j, 0x66); emit8(j, 0x41); emit8(j, 0x89); emit8(j, (uint8_t)(0xC0 | r1));
+            host_flags = HOST_FLAGS_NONE;
+            if (need_flags[k]) {
+                uint32_t f = CPU_OFF(cu.aluflags);
+                emit8(j, 0xA9); emit32(j, 0xFFFF0000u);                     // test eax, hi
+                emit_setcc_cpu(j, CC_NZ, f + offsetof(struct ALUFlags, cy));
+                emit_setcc_cpu(j, CC_NZ, f + offsetof(struct ALUFlags, ov));
+                emit8(j, 0x66); emit8(j, 0x85); emit8(j, 0xC0);             // test ax, ax
+                emit_flags(j, ALU_MUL, 0);
+                host_flags = HOST_FLAGS_ZS;   // test cleared CF/OF, not the guest's
+            }
+        } else if (op == LOAD) {
+            emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, (uint8_t)(0xC0 | r2));
+            emit_page_lookup(j);
+            emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, 0x0C); emit8(j, 0x41); // movzx ecx, [rcx + rax*2]
+            emit8(j, 0x66); emit8(j, 0x41); emit8(j, 0x89); emit8(j, (uint8_t)(0xC8 | r1));
+            host_flags = HOST_FLAGS_NONE;
+        } else if (op == STORE) {
+            // MMIO, self-modifying and first-write-to-page stores go to the interpreter
+            struct JitExit side = { 0, addr[k],
+                                    k ? words[k - 1] : 0, (uint8_t)(k > 0),
+                                    (uint32_t)(n - k) };
+
+            emit8(j, 0x41); emit8(j, 0x0F); emit8(j, 0xB7); emit8(j, (uint8_t)(0xC0 | r2));
+            emit8(j, 0x8D); emit8(j, 0x48); emit8(j, (uint8_t)-MMIO_CHAR_OUT); // lea ecx, [rax - mmio]
+            emit8(j, 0x83); emit8(j, 0xF9); emit8(j, MMIO_FLUSH - MMIO_CHAR_OUT); // cmp ecx, ports - 1
+            side.site = emit_jcc(j, CC_BE);
+            exits[n_exits++] = side;
+            emit8(j, 0x89); emit8(j, 0xC1);                                 // mov ecx, eax
+            emit8(j, 0xC1); emit8(j, 0xE9); emit8(j, PAGE_SHIFT);           // shr ecx, PAGE_SHIFT
+            emit8(j, 0x80); emit8(j, 0xBC); emit8(j, 0x0F);                 // cmp owned[rcx], 0
+            emit32(j, CPU_OFF(mainMemory.owned));
+            emit8(j, 0x00);
+            side.site = emit_jcc(j, CC_Z);
+            exits[n_exits++] = side;
+
+            // Only the code window has decodes to drop
+            emit8(j, 0x3D); emit32(j, CODE_SIZE);                           // cmp eax, CODE_SIZE
+            emit8(j, 0x73); emit8(j, 0x00);                                 // jae data
+            uint32_t data = j->size - 1;
+            emit8(j, 0x80); emit8(j, 0x3C); emit8(j, 0x03); emit8(j, 0x00); // cmp code_map[rax], 0
+            side.site = emit_jcc(j, CC_NZ);
+            exits[n_exits++] = side;
+            emit8(j, 0x48); emit8(j, 0x69); emit8(j, 0xC8);                 // imul rcx, rax, size
+            emit32(j, (uint32_t)sizeof(struct DecodedInstr));
+            for (int f = 0; f < FUSE_MAX; f++) {                           // decoded[rax - f].exec = 0
+                emit8(j, 0x48); emit8(j, 0xC7); emit8(j, 0x84); emit8(j, 0x0F);
+                emit32(j, CPU_OFF(decoded.entry) + offsetof(struct DecodedInstr, exec) -
+                          f * (uint32_t)sizeof(struct DecodedInstr));
+                emit32(j, 0);
+            }
+            j->code[data] = (uint8_t)(j->size - (data + 1));
+
+            emit_page_lookup(j);
+            emit8(j, 0x66); emit8(j, 0x44); emit8(j, 0x89);                 // mov [rcx + rax*2], r1w
+            emit8(j, (uint8_t)(0x04 | r1 << 3)); emit8(j, 0x41);
+            host_flags = HOST_FLAGS_NONE;
+        } else if (op == JMP) {
+            emit_store_cpu16(j, CPU_OFF(cu.IR), w);
+            emit_chain(j, imm, exits, &n_exits);
+        } else if (op == JZ) {
+            uint8_t cond = BRANCH_COND(w);
+            uint32_t taken;
+            emit_store_cpu16(j, CPU_OFF(cu.IR), w);
+            if (cond == COND_DJNZ) {
+                emit8(j, 0x66); emit8(j, 0x41); emit8(j, 0x83);             // sub r(8+r1)w, 1
+                emit8(j, (uint8_t)(0xE8 | r1)); emit8(j, 0x01);
+                if (need_flags[k]) emit_flags(j, ALU_SUB, 1);
+                taken = emit_jcc(j, CC_NZ);
+            } else if (host_flags == HOST_FLAGS_ALL ||
+                       (host_flags == HOST_FLAGS_ZS && cond <= COND_NN)) {
+                taken = emit_jcc(j, COND_HOST_CC[cond]);
+            } else {
+                emit8(j, 0x80); emit8(j, 0xBF);                             // cmp flag, 0
+                emit32(j, CPU_OFF(cu.aluflags) + COND_FLAG_OFF[cond]);
+                emit8(j, 0x00);
+                taken = emit_jcc(j, COND_ON_SET[cond] ? CC_NZ : CC_Z);
+            }
+            emit_chain(j, end, exits, &n_exits);
+            patch_rel32(j, taken, j->size);
+            emit_chain(j, imm, exits, &n_exits);
+        }
+        // NOP emits nothing
+    }
+
+    // Fell off the end (block limit or an interpreter-only instruction)
+    uint8_t last_op = (words[n - 1] >> 12) & 0xF;
+    if (last_op != JMP && last_op != JZ) {
+        emit_store_cpu16(j, CPU_OFF(cu.IR), words[n - 1]);
+        emit_chain(j, end, exits, &n_exits);
+    }
+
+    // Out-of-line exit stubs
+    for (int e = 0; e < n_exits; e++) {
+        patch_rel32(j, exits[e].site, j->size);
+        if (exits[e].refund) {
+            emit8(j, 0x48); emit8(j, 0x81); emit8(j, 0xC5);                 // add rbp, refund
+            emit32(j, exits[e].refund);
+        }
+        emit_store_cpu16(j, CPU_OFF(cu.IP), exits[e].ip);
+        if (exits[e].write_ir) {
+            emit_store_cpu16(j, CPU_OFF(cu.IR), exits[e].ir);
+        }
+        patch_rel32(j, emit_jmp(j), j->exit);
+    }
+
+    // Publish the block and link earlier exits that were waiting for it
+    for (word_t a = start; a < end; a++) {
+        j->code_map[a] = 1;
+    }
+    j->block[start] = entry;
+    for (uint32_t p = 0; p < j->patch_count; p++) {
+        if (j->patch[p].target == start) {
+            patch_rel32(j, j->patch[p].site, (uint32_t)(entry - j->code));
+            j->patch[p--] = j->patch[--j->patch_count];
+        }
+    }
+    return entry;
+}
+
+// A write to compiled code throws every block away
+static void jit_invalidate(struct CPU *cpu, word_t address) {
+    if (cpu->jit && address < CODE_SIZE && cpu->jit->code_map[address]) {
+        jit_flush(cpu->jit);
+    }
+}
+
+// Run compiled blocks (and the interpreter where they stop) for up to
+// budget instructions; returns how many were executed
+static uint64_t jit_execute(struct CPU *cpu, uint64_t budget) {
+    struct JIT *j = cpu->jit;
+    jit_enter_fn enter = (jit_enter_fn)(void *)j->code;
+    uint64_t executed = 0;
+
+    while (cpu->running && executed < budget) {
+        word_t ip = cpu->cu.IP;
+        uint8_t *entry = NULL;
+
+        if (ip < CODE_SIZE && !j->interp_only[ip]) {
+            entry = j->block[ip] ? j->block[ip] : jit_compile(j, cpu, ip);
+        }
+        if (entry) {
+            int64_t left = enter(cpu, entry, (int64_t)(budget - executed));
+            uint64_t ran = (budget - executed) - (uint64_t)left;
+            if (ran > 0) {
+                executed += ran;
+                continue;
+            }
+        }
+        // Interpreter-only instruction, or too little budget for the block
+        executed += fetch_decode_execute(cpu, budget - executed >= FUSE_MAX);
+    }
+    return executed;
+}
+
+#else  /* no JIT on this host: every CPU keeps interpreting */
+
+struct JIT *jit_create(void) { return NULL; }
+void jit_destroy(struct JIT *j) { (void)j; }
+static void jit_flush(struct JIT *j) { (void)j; }
+static void jit_invalidate(struct CPU *cpu, word_t address) { (void)cpu; (void)address; }
+static uint64_t jit_execute(struct CPU *cpu, uint64_t budget) { (void)cpu; (void)budget; return 0; }
+
+#endif
+
+/* ---------------- Run loop ---------------- */
+
+int cpu_step(struct CPU *cpu) {
+    return fetch_decode_execute(cpu, 0);
+}
+
+int cpu_is_halted(const struct CPU *cpu) {
+    return !cpu->running;
+}
+
+struct CPURunResult cpu_run(struct CPU *cpu, uint64_t max_cycles) {
+    struct CPURunResult res = { 0, CPU_STOP_BUDGET };
+
+    // Compiled code can't report individual instructions or drive the
+    // reference ALU, so tracing, profiling, timing models and ALU_REFERENCE
+    // stay on the interpreter
+    if (cpu->jit && !cpu->trace.enabled && !cpu->on_step && !cpu->profile &&
+        !timing_models(cpu) && cpu->alu_mode == ALU_FAST) {
+        while (cpu->running && res.cycles < max_cycles) {
+            uint64_t left = max_cycles - res.cycles;
+            res.cycles += jit_execute(cpu, left < INT64_MAX ? left : INT64_MAX);
+        }
+    } else {
+        // Fused idioms run several instructions, so stop fusing near the end
+        while (cpu->running && res.cycles < max_cycles) {
+            res.cycles += fetch_decode_execute(cpu, max_cycles - res.cycles >= FUSE_MAX);
+        }
+    }
+
+    if (!cpu->running) {
+        res.reason = cpu->fault ? CPU_STOP_FAULT : CPU_STOP_HALT;
+    }
+    return res;
+}
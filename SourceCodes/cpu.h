@@ -0,0 +1,486 @@
+// cpu.h
+// Public interface of the CMPE220 CPU core (cpu.c).
+//
+// Drivers include this header and link cpu.c:
+//     gcc -std=c11 timer.c cpu.c -o timer
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#define WORD_SIZE 16
+#define STACK_SIZE 1000
+#define MMIO_CHAR_OUT 32  // Memory-mapped I/O address for character output
+#define MMIO_FLUSH 33     // Any write flushes buffered console output
+#define ADDRESS_SPACE 65536  // Words addressable by a 16-bit address
+#define CODE_SIZE 400     // Low words that can hold code; the stack tops out here too
+#define PAGE_SHIFT 8      // Memory is mapped in pages of 1 << PAGE_SHIFT words
+#define PAGE_WORDS (1 << PAGE_SHIFT)
+#define PAGE_COUNT (ADDRESS_SPACE >> PAGE_SHIFT)
+#define TRACE_SIZE 64     // Instructions kept by the ring-buffer tracer
+#define CONSOLE_BUF_SIZE 4096  // Largest console output buffer, in bytes
+
+typedef uint16_t word_t;
+
+enum {
+    NOP, MOV, ADD, SUB, AND, OR, MUL, DIV,
+    JMP, JZ, CALL, RET, HALT, LOAD, STORE, MOVW
+};
+
+// Words taken by the instruction whose first word is w: MOVW r1 is
+// followed by its 16-bit immediate, everything else is one word
+#define INSTR_WORDS(w) ((((w) >> 12) & 0xF) == MOVW ? 2 : 1)
+
+// MOV, ADD and SUB leave the R2 field unused for an immediate. Its low
+// bit (encodeR sets it) selects the register form, whose source register
+// is the low three bits of IMM: MOV R1, Rs / ADD R1, Rs / SUB R1, Rs.
+#define IS_REG_FORM(w) ((((w) >> 12) & 0xF) >= MOV && (((w) >> 12) & 0xF) <= SUB && \
+                        (((w) >> 6) & 0x1) != 0)
+
+// SUB with R2 bit 1 set is CMP: the flags of R1 - operand, R1 unchanged
+#define IS_CMP(w) ((((w) >> 12) & 0xF) == SUB && (((w) >> 7) & 0x1) != 0)
+
+// The JZ opcode is the conditional branch; its R2 field picks the
+// condition (R1 and R2 were unused, so plain JZ keeps condition 0).
+// DJNZ decrements R1 like SUB R1, 1 and jumps if the result is nonzero.
+enum {
+    COND_Z, COND_NZ, COND_N, COND_NN, COND_C, COND_O, COND_NC, COND_DJNZ
+};
+
+#define BRANCH_COND(w) (((w) >> 6) & 0x7)
+
+extern const char *OPCODE_STRINGS[];
+
+struct ALUFlags {
+    uint8_t zx, nx, zy, ny, f, no;   // control flags
+    uint8_t zr, ng, ov, cy;          // status flags
+};
+
+struct ALU {
+    word_t x, y, out;
+    struct ALUFlags flags;
+};
+
+// Sparse 64K-word address space. Every page[] entry is valid once the CPU
+// is reset or loaded: pages never written point at a shared zero page, so
+// a read is two loads and no bounds check. Writes allocate (or copy, for
+// pages shared with a snapshot) any page the CPU doesn't own yet.
+struct Memory {
+    word_t *page[PAGE_COUNT];
+    uint8_t owned[PAGE_COUNT];    // page[i] belongs to this CPU and may be written
+};
+
+struct CPU;
+struct DecodedInstr;
+struct JIT;
+
+typedef void (*exec_fn)(struct CPU *cpu, const struct DecodedInstr *di);
+
+// One predecoded memory word; exec == NULL means "not decoded yet".
+// exec may be a fused handler covering len consecutive words.
+struct DecodedInstr {
+    exec_fn exec;
+    uint8_t op, r1, r2, imm;
+    uint8_t len;      // guest instructions executed by exec (1-3)
+    uint8_t imm2;     // immediate of the second fused instruction
+    uint8_t cond;     // conditional branch: its COND_*
+    word_t last;      // last word of a fused sequence, latched into IR
+    word_t wide;      // MOVW: the immediate word that follows
+};
+
+#define FUSE_MAX 3    // longest fused sequence, in words
+
+// Parallels struct Memory: entry[i] caches the decode of mem[i].
+// A fused entry depends on the words after it, so a write to mem[i]
+// also drops entry[i-1] and entry[i-2]; the guard slots let compiled
+// code do that without a bounds check.
+struct DecodeCache {
+    struct DecodedInstr guard[FUSE_MAX - 1];
+    struct DecodedInstr entry[CODE_SIZE];
+};
+
+struct GPR {
+    word_t reg[8];
+};
+
+struct SPR {
+    word_t SP;
+};
+
+struct CU {
+    word_t IP, IR;
+    struct ALUFlags aluflags;
+};
+
+// One executed instruction as seen by the tracer
+struct TraceRecord {
+    word_t IP;        // address the instruction was fetched from
+    word_t IR;
+    word_t before;    // value of the written register before execution
+    word_t after;     // ... and after
+    int8_t reg;       // register that changed, -1 if none
+    uint8_t flags;    // ZR | NG << 1 | OV << 2 | CY << 3 after execution
+};
+
+// Fixed-size ring of the most recent TraceRecords; off unless enabled
+struct Tracer {
+    struct TraceRecord rec[TRACE_SIZE];
+    uint32_t count;   // records written so far; next slot is count % TRACE_SIZE
+    uint8_t enabled;
+};
+
+// Execution counters kept while cpu->profile is set. Plain arrays bumped
+// once per dispatch; conditional branch sites record taken branches, the
+// rest of their addr[] count fell through.
+struct Profile {
+    uint64_t op[16];                  // per opcode, indexed like OPCODE_STRINGS
+    uint64_t addr[CODE_SIZE];         // per instruction address
+    uint64_t call[CODE_SIZE];         // per CALL target
+    uint64_t taken[CODE_SIZE];        // per conditional branch address
+    FILE *report;                     // hot-spot report at HALT, NULL for none
+};
+
+// Timing parameters of the pipeline model; PIPELINE_DEFAULTS is the usual setup
+struct PipelineConfig {
+    uint8_t forwarding;   // results bypass to EX and MEM; 0: operands wait for WB
+    uint8_t mul_cycles;   // EX cycles of MUL, which holds EX until it is done
+    uint8_t div_cycles;   // ... of DIV
+};
+
+#define PIPELINE_DEFAULTS ((struct PipelineConfig){ 1, 3, 12 })
+
+// Why an instruction entered EX later than it could have
+enum {
+    STALL_DATA,         // waiting for an operand (read after write)
+    STALL_LOAD_USE,     // ... that a LOAD is still reading
+    STALL_MULTICYCLE,   // MUL or DIV holding EX
+    STALL_CONTROL,      // refetch after a JMP, CALL, RET or branch that was not predicted
+    STALL_FETCH,        // second word of a MOVW
+    STALL_ICACHE,       // instruction fetch missed in L1I
+    STALL_DCACHE,       // LOAD, STORE, CALL or RET missed in L1D, holding MEM
+    STALL_COUNT
+};
+
+// Timing of an in-order IF/ID/EX/MEM/WB pipeline, worked out instruction by
+// instruction as the interpreter runs. Each instruction enters a stage as
+// soon as the one before has left it and its operands can be forwarded;
+// every cycle it loses is charged to one STALL_* cause and one address.
+// With a Predictor attached, correctly predicted transfers cost nothing;
+// with a Cache, misses hold IF or MEM for their penalty.
+struct Pipeline {
+    struct PipelineConfig config;
+    uint64_t instructions;
+    uint64_t stalls[STALL_COUNT];
+    uint64_t stall_at[CODE_SIZE];     // stall cycles per instruction address
+    uint64_t branches, jumps, returns; // refetches after branches, JMP/CALL, RET
+    uint64_t if_at, id_at, ex_at;     // cycles the last instruction entered IF, ID, EX
+    uint64_t ex_cycles;               // ... and how long it stays in EX
+    uint64_t mem_stall;               // ... and extra cycles in MEM waiting for L1D
+    uint64_t fetch_at;                // earliest fetch after a control transfer, else 0
+    word_t refetch_site;              // the transfer that set fetch_at
+    uint64_t ready[10];               // R0-R7, flags, SP: first EX cycle that can use them
+    uint8_t loaded[10];               // ... last written by a LOAD
+    FILE *report;                     // timing report at HALT, NULL for none
+};
+
+// Branch predictors, chosen at runtime. All of them see the opcode and
+// target of a transfer as it is fetched; they differ in how conditional
+// branches are guessed:
+enum {
+    PREDICT_NONE,       // fetch straight on; only RET can hit, on the return stack
+    PREDICT_STATIC,     // backward taken, forward not taken; JMP/CALL taken
+    PREDICT_BIMODAL,    // 2-bit saturating counter per branch address
+    PREDICT_GSHARE,     // 2-bit counters indexed by address XOR global history
+    PREDICT_KINDS
+};
+
+#define PREDICT_TABLE_BITS 10   // 2-bit counters in the bimodal and gshare tables
+#define PREDICT_RAS_MAX    16   // deepest return-address stack
+
+// Kinds of control transfer the predictor reports on
+enum { XFER_BRANCH, XFER_JUMP, XFER_RETURN, XFER_COUNT };
+
+// Prediction state and outcome counts. RET targets come from a
+// return-address stack of ras_depth entries (0: RET is never predicted)
+// that CALL pushes and that overwrites its oldest entry when full.
+struct Predictor {
+    uint8_t kind;                           // PREDICT_*
+    uint8_t ras_depth;
+    uint8_t counter[1 << PREDICT_TABLE_BITS];
+    uint16_t history;                       // last branch outcomes, newest in bit 0
+    word_t ras[PREDICT_RAS_MAX];
+    uint8_t ras_top, ras_used;
+    uint64_t seen[XFER_COUNT], missed[XFER_COUNT];
+    uint64_t site_seen[CODE_SIZE];          // transfers per instruction address
+    uint64_t site_missed[CODE_SIZE];        // ... that were mispredicted
+    int8_t last;                            // 1 predicted, 0 missed, -1 no transfer last
+    FILE *report;                           // accuracy report at HALT, NULL for none
+};
+
+// Cache levels, replacement policies and the regions accesses are counted by
+enum { CACHE_L1I, CACHE_L1D, CACHE_L2, CACHE_LEVELS };
+enum { CACHE_LRU, CACHE_FIFO, CACHE_RANDOM, CACHE_POLICIES };
+enum { REGION_CODE, REGION_DATA, REGION_STACK, REGION_COUNT };
+
+struct CacheGeometry {
+    uint32_t words;        // capacity, 0: no cache at this level
+    uint16_t line_words;   // words per line, a power of two
+    uint16_t ways;         // lines per set; words / line_words is fully associative
+    uint8_t policy;        // CACHE_LRU, CACHE_FIFO or CACHE_RANDOM
+};
+
+// Split L1 in front of an optional unified L2. An L1 miss costs l2_cycles
+// when L2 has the line, and memory_cycles more when it has to go to memory.
+struct CacheConfig {
+    struct CacheGeometry level[CACHE_LEVELS];
+    uint16_t l2_cycles;
+    uint16_t memory_cycles;
+};
+
+#define CACHE_DEFAULTS ((struct CacheConfig){ \
+    { { 256, 4, 2, CACHE_LRU }, { 256, 4, 2, CACHE_LRU }, { 2048, 8, 4, CACHE_LRU } }, 6, 30 })
+
+struct CacheLine {
+    uint32_t tag;
+    uint8_t valid;
+    uint8_t region;        // REGION_* of the access that filled it
+    uint64_t stamp;        // last use (LRU) or fill (FIFO)
+};
+
+struct CacheLevel {
+    struct CacheGeometry geometry;
+    uint32_t sets;
+    struct CacheLine *line;   // sets * ways, set by set
+    uint64_t hits[REGION_COUNT], misses[REGION_COUNT];
+    uint64_t evictions[REGION_COUNT];   // valid lines of the region replaced
+};
+
+// Cache hierarchy seen by instruction fetch and by the memory accesses of
+// LOAD, STORE, CALL and RET. Caches allocate on writes too and write back
+// without stalling, so reads and writes cost the same. Only hit or miss is
+// modelled; memory contents do not go through it.
+struct Cache {
+    struct CacheConfig config;
+    struct CacheLevel level[CACHE_LEVELS];
+    uint64_t clock;                    // accesses so far, for LRU and FIFO stamps
+    uint32_t seed;                     // CACHE_RANDOM victims
+    uint64_t penalty[REGION_COUNT];    // miss cycles by region
+    uint64_t fetch_penalty;            // miss cycles of the current instruction's fetch
+    uint64_t data_penalty;             // ... and of its memory access
+    FILE *report;                      // cache report at HALT, NULL for none
+};
+
+typedef void (*step_hook_fn)(struct CPU *cpu, const struct TraceRecord *rec);
+
+// Where the character-out port ends up
+enum { CONSOLE_STDOUT, CONSOLE_FILE, CONSOLE_CAPTURE };
+
+// Character output device behind MMIO_CHAR_OUT. Bytes collect in buf and
+// reach the sink on newline, buffer-full, HALT/fault or a MMIO_FLUSH write.
+// Zero-initialised it writes to stdout with a full-size buffer.
+struct Console {
+    char buf[CONSOLE_BUF_SIZE];
+    size_t len;              // pending bytes in buf
+    size_t limit;            // flush threshold, 0 or > CONSOLE_BUF_SIZE = full size
+    uint8_t sink;            // CONSOLE_STDOUT, CONSOLE_FILE or CONSOLE_CAPTURE
+    FILE *file;              // CONSOLE_FILE target
+    char *capture;           // CONSOLE_CAPTURE text, NUL-terminated
+    size_t capture_len, capture_cap;
+};
+
+// Machine state comes first, up to trace, so a snapshot is one memcpy;
+// the fields from trace on are host-side settings that a restore keeps.
+struct CPU {
+    struct Memory mainMemory;
+    struct GPR gpr;
+    struct SPR spr;
+    struct CU cu;
+    struct ALU alu;
+    struct DecodeCache decoded;
+    const char *fault;       // why the CPU stopped, NULL after a clean HALT
+    int running;
+    word_t static_counter;   // guest call depth (CALL increments, RET decrements)
+
+    struct Tracer trace;
+    struct Console console;
+    step_hook_fn on_step;    // optional per-instruction callback (verbose demos)
+    uint8_t alu_mode;        // ALU_FAST (default) or ALU_REFERENCE
+    struct JIT *jit;         // optional compiled tier, NULL to interpret only
+    struct Profile *profile; // optional execution counters, NULL when off
+    struct Pipeline *pipeline; // optional timing model, NULL when off
+    struct Predictor *predictor; // optional branch predictor, NULL when off
+    struct Cache *cache;     // optional cache model, NULL when off
+};
+
+#define CPU_STATE_SIZE offsetof(struct CPU, trace)
+
+// Saved machine state of a CPU: page table, registers, SP, IP, IR, flags,
+// run state and the decode cache, which stays valid for the same memory.
+// Pages are shared copy-on-write between a snapshot and its CPUs.
+struct CPUSnapshot {
+    _Alignas(struct CPU) unsigned char state[CPU_STATE_SIZE];
+};
+
+// 6-bit control word d = zx nx zy ny f no, one value per ALU operation
+enum {
+    ALU_AND     = 0b000000,   // x & y
+    ALU_ADD     = 0b000010,   // x + y
+    ALU_RSUB    = 0b000111,   // y - x
+    ALU_X       = 0b001100,
+    ALU_NOT_X   = 0b001101,
+    ALU_X_DEC   = 0b001110,   // x - 1
+    ALU_NEG_X   = 0b001111,
+    ALU_SUB     = 0b010011,   // x - y
+    ALU_OR      = 0b010101,   // x | y
+    ALU_X_INC   = 0b011111,   // x + 1
+    ALU_ZERO    = 0b101010,
+    ALU_Y       = 0b110000,
+    ALU_NOT_Y   = 0b110001,
+    ALU_Y_DEC   = 0b110010,   // y - 1
+    ALU_NEG_Y   = 0b110011,
+    ALU_Y_INC   = 0b110111,   // y + 1
+    ALU_NEG_ONE = 0b111010,
+    ALU_MUL     = 0b111100,
+    ALU_DIV     = 0b111101,
+    ALU_ONE     = 0b111111
+};
+
+// ALU backends selectable per CPU through cpu->alu_mode
+enum {
+    ALU_FAST,        // word-level handlers dispatched through ALU_FAST_OPS
+    ALU_REFERENCE    // gate-level bit-serial datapath (alu_compute)
+};
+
+// Why cpu_run returned
+enum {
+    CPU_STOP_HALT,     // executed HALT
+    CPU_STOP_FAULT,    // stopped with an error, see cpu->fault
+    CPU_STOP_BUDGET    // ran max_cycles instructions and is still running
+};
+
+struct CPURunResult {
+    uint64_t cycles;   // instructions executed by this call
+    int reason;        // CPU_STOP_*
+};
+
+#define CPU_RUN_UNLIMITED UINT64_MAX
+
+/* ---------------- Core API ---------------- */
+
+// Clear registers, memory and caches; keeps the JIT, ALU mode, hooks and
+// console settings. The CPU is left running at IP 0 with an empty stack.
+// A CPU must be reset, loaded or restored before it runs.
+void cpu_reset(struct CPU *cpu);
+
+// Copy size words to memory at start_ip and start executing there
+void cpu_load_program(struct CPU *cpu, const word_t *program, size_t size, word_t start_ip);
+
+// Load size words at address load without copying them and start at entry.
+// program is shared until each page is first written, so it must stay
+// valid (e.g. mapped) until the CPU is released, reset or loaded again.
+void cpu_map_program(struct CPU *cpu, const word_t *program, size_t size,
+                     word_t load, word_t entry);
+
+// Free the memory pages cpu owns; call before discarding or clearing a
+// CPU that has run. The CPU must be reset or loaded before running again.
+void cpu_release(struct CPU *cpu);
+
+// Execute exactly one instruction; returns 1, or 0 if the CPU has stopped
+int cpu_step(struct CPU *cpu);
+
+// Run until HALT, a fault or max_cycles instructions, whichever comes first
+struct CPURunResult cpu_run(struct CPU *cpu, uint64_t max_cycles);
+
+int cpu_is_halted(const struct CPU *cpu);
+
+// Checkpoint and rewind the machine state in one copy. Pending console
+// output is flushed first, so it stays with the run that produced it.
+// Memory pages are not copied: the snapshot takes over the CPU's pages
+// and both sides copy a page on their next write to it. A snapshot must
+// outlive the CPUs restored from it; cpu_snapshot_free drops its pages.
+void cpu_snapshot(struct CPU *cpu, struct CPUSnapshot *snap);
+void cpu_restore(struct CPU *cpu, const struct CPUSnapshot *snap);
+void cpu_snapshot_free(struct CPUSnapshot *snap);
+
+// Restore snap into count initialised (e.g. zeroed) CPUs; each keeps its
+// own JIT, console, hooks and profile
+void cpu_fork(const struct CPUSnapshot *snap, struct CPU *clones, size_t count);
+
+// Store value at address without MMIO side effects (for setting up runs)
+void cpu_poke(struct CPU *cpu, word_t address, word_t value);
+word_t cpu_peek(const struct CPU *cpu, word_t address);
+
+// Whether any word of page has been written (by cpu or before its snapshot)
+int cpu_page_mapped(const struct CPU *cpu, unsigned page);
+
+// Hash of the architectural state: R0-R7, the ZR/NG/OV/CY flags, IP, SP,
+// call depth, run state and memory. Equal states hash equal however they
+// were reached, so two execution backends can be compared cheaply.
+uint64_t cpu_state_hash(const struct CPU *cpu);
+
+// Optional x86-64 compiled tier; returns NULL where unsupported
+struct JIT *jit_create(void);
+void jit_destroy(struct JIT *j);
+
+// Zeroed counters that print their report to report (may be NULL) at HALT.
+// Profiling keeps the CPU on the interpreter.
+struct Profile *profile_create(FILE *report);
+void profile_destroy(struct Profile *p);
+void profile_report(const struct CPU *cpu, FILE *out);
+
+// Pipeline timing model that prints its report to report (may be NULL) at
+// HALT. Like profiling, it keeps the CPU on the interpreter, without fusion.
+struct Pipeline *pipeline_create(struct PipelineConfig config, FILE *report);
+void pipeline_destroy(struct Pipeline *p);
+uint64_t pipeline_cycles(const struct Pipeline *p);
+void pipeline_report(const struct CPU *cpu, FILE *out);
+
+// Branch prediction: attach with cpu.predictor = predictor_create(...).
+// predictor_kind maps "none", "static", "2bit" or "gshare" to PREDICT_*,
+// or returns -1.
+struct Predictor *predictor_create(int kind, int ras_depth, FILE *report);
+void predictor_destroy(struct Predictor *p);
+int predictor_kind(const char *name);
+void predictor_report(const struct CPU *cpu, FILE *out);
+
+// Cache model: attach with cpu.cache = cache_create(...), which returns NULL
+// for a geometry that does not divide into whole sets. cache_configure
+// applies a spec such as "l1d=512/8/4/fifo,l2=off,memory=50" to config and
+// returns why it was rejected, or NULL.
+struct Cache *cache_create(struct CacheConfig config, FILE *report);
+void cache_destroy(struct Cache *c);
+const char *cache_configure(struct CacheConfig *config, const char *spec);
+void cache_report(const struct CPU *cpu, FILE *out);
+
+// One instruction word; MOVW is written as encodeI(MOVW, r, 0, 0), value
+word_t encodeI(uint8_t op, uint8_t r1, uint8_t r2, uint8_t imm);
+// Register form of MOV/ADD/SUB: R1 = Rs, R1 += Rs, R1 -= Rs
+word_t encodeR(uint8_t op, uint8_t r1, uint8_t rs);
+// Conditional branch to target; r1 is the counter of COND_DJNZ.
+// CMP is encodeI(SUB, r1, 2, imm), or encodeI(SUB, r1, 3, rs) for a register.
+word_t encodeJ(uint8_t cond, uint8_t r1, uint8_t target);
+void alu_set_control(struct ALUFlags *f, uint8_t d);
+
+/* ---------------- Debugging and tracing ---------------- */
+
+// Mnemonic of the instruction word w: OPCODE_STRINGS, except that
+// conditional branches and CMP get their own names
+const char *instr_name(word_t w);
+void dump_memory(struct CPU *cpu);
+void dump_registers(struct CPU *cpu);
+void trace_enable(struct CPU *cpu);
+void trace_dump(const struct CPU *cpu, FILE *out);
+void print_register_line(const struct CPU *cpu);
+void trace_print_cycle(struct CPU *cpu, const struct TraceRecord *rec);
+
+/* ---------------- Console output device ---------------- */
+
+void console_open(struct Console *con, uint8_t sink, FILE *file, size_t buffer_size);
+void console_putc(struct Console *con, char c);
+void console_flush(struct Console *con);
+void console_close(struct Console *con);
+
+#endif /* CPU_H */
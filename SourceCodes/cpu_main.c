@@ -0,0 +1,76 @@
+// cpu_main.c
+// Test program for the CPU core: exercises every opcode once.
+//
+//     gcc -std=c11 cpu_main.c cpu.c -o cpu
+
+#include <string.h>
+
+#include "cpu.h"
+
+int main(int argc, char *argv[]) {
+    struct CPU cpu = {0};
+
+    // -v: print every instruction, -t: keep a ring-buffer trace,
+    // -g: use the gate-level reference ALU, -j: enable the JIT tier,
+    // -p: print an execution profile at HALT, -c: print pipeline timing at HALT;
+    // default: silent, interpreted, fast ALU
+    int verbose = 0, tracing = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) verbose = 1;
+        else if (strcmp(argv[i], "-t") == 0) tracing = 1;
+        else if (strcmp(argv[i], "-g") == 0) cpu.alu_mode = ALU_REFERENCE;
+        else if (strcmp(argv[i], "-j") == 0) cpu.jit = jit_create();
+        else if (strcmp(argv[i], "-p") == 0) cpu.profile = profile_create(stdout);
+        else if (strcmp(argv[i], "-c") == 0) cpu.pipeline = pipeline_create(PIPELINE_DEFAULTS, stdout);
+    }
+
+    word_t test_program[] = {
+        // Test all opcodes
+        encodeI(NOP, 0, 0, 0),    // NOP
+        encodeI(MOV, 0, 0, 10),   // R0 = 10
+        encodeI(MOV, 1, 0, 5),    // R1 = 5
+        encodeI(ADD, 2, 0, 3),    // R2 = R2 + 3
+        encodeI(SUB, 0, 0, 2),    // R0 = R0 - 2
+        encodeI(MOV, 3, 0, 12),   // R3 = 12 (for AND/OR test)
+        encodeI(MOV, 4, 0, 9),    // R4 = 9 (for AND/OR test)
+        encodeI(AND, 3, 4, 0),    // R3 = R3 & R4
+        encodeI(OR,  4, 3, 0),    // R4 = R4 | R3
+        encodeI(MUL, 1, 0, 0),    // R1 = R1 * R0
+        encodeI(MOVW, 5, 0, 0), 100,  // R5 = 100 (two words)
+        encodeI(MOV, 6, 0, 5),    // R6 = 5
+        encodeI(DIV, 5, 6, 0),    // R5 = R5 / R6
+        encodeI(JMP, 0, 0, 16),   // Jump to position 16
+        encodeI(HALT,0, 0, 0),    // This HALT will be skipped
+        encodeI(SUB, 6, 0, 5),    // R6 = R6 - 5
+        encodeI(JZ,  0, 0, 19),   // If ZR flag is set, jump to CALL
+        encodeI(HALT,0, 0, 0),    // This HALT will be skipped if R6 == 0
+        encodeI(CALL,0, 0, 21),   // Call subroutine
+        encodeI(HALT,0, 0, 0),    // Final HALT
+        // Subroutine
+        encodeI(MOV, 7, 0, 42),   // R7 = 42
+        encodeI(RET, 0, 0, 0)     // Return from subroutine
+    };
+
+    cpu_load_program(&cpu, test_program,
+                     sizeof(test_program) / sizeof(test_program[0]), 0);
+    if (verbose) cpu.on_step = trace_print_cycle;
+    if (tracing) trace_enable(&cpu);
+
+    struct CPURunResult res = cpu_run(&cpu, CPU_RUN_UNLIMITED);
+
+    if (res.reason == CPU_STOP_FAULT) {
+        printf("%s\n", cpu.fault);
+    } else {
+        printf("[CPU] Program HALTED.\n");
+    }
+    if (tracing) trace_dump(&cpu, stdout);
+    dump_registers(&cpu);
+    dump_memory(&cpu);
+    jit_destroy(cpu.jit);
+    profile_destroy(cpu.profile);
+    pipeline_destroy(cpu.pipeline);
+    cpu_release(&cpu);
+    console_close(&cpu.console);
+
+    return 0;
+}
@@ -0,0 +1,114 @@
+// cpurun.c
+// Runs a program image (.bin from the assembler or linker) directly.
+//
+// The image is mapped read-only and its header checked (see image.h);
+// cpu_map_program then shares the mapped words with guest memory, so
+// nothing is copied or rebuilt and startup does not grow with the image.
+// The program's console output goes to stdout.
+//
+// Usage: cpurun [-j] [-g] [-v] [-t] [-p] [-c] [-F] [-b predictor] [-R depth]
+//               [-C caches] [-r] [-n max_instr] program.bin
+// Build: gcc -std=c11 -O2 cpurun.c image.c cpu.c -o cpurun
+//
+// Exit status: 0 at HALT, 1 on a fault or a bad image, 2 if -n ran out.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "image.h"
+
+int main(int argc, char *argv[]) {
+    struct CPU cpu = {0};
+    const char *path = NULL;
+    uint64_t limit = CPU_RUN_UNLIMITED;
+
+    // -j: JIT, -g: gate-level reference ALU, -v: print every instruction,
+    // -t: keep a ring-buffer trace, -p: profile, -c: pipeline timing,
+    // -F: time it without forwarding, -b: branch predictor (none, static,
+    // 2bit, gshare), -R: its return-stack depth, -C: cache model ("default"
+    // or changes to it, see cache_configure), -r: registers at exit
+    struct PipelineConfig pipe = PIPELINE_DEFAULTS;
+    struct CacheConfig caches = CACHE_DEFAULTS;
+    const char *cache_spec = NULL;
+    int verbose = 0, tracing = 0, registers = 0, timing = 0;
+    int predictor = -1, ras_depth = 8;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) verbose = 1;
+        else if (strcmp(argv[i], "-t") == 0) tracing = 1;
+        else if (strcmp(argv[i], "-r") == 0) registers = 1;
+        else if (strcmp(argv[i], "-c") == 0) timing = 1;
+        else if (strcmp(argv[i], "-F") == 0) timing = 1, pipe.forwarding = 0;
+        else if (strcmp(argv[i], "-g") == 0) cpu.alu_mode = ALU_REFERENCE;
+        else if (strcmp(argv[i], "-j") == 0) cpu.jit = jit_create();
+        else if (strcmp(argv[i], "-p") == 0) cpu.profile = profile_create(stdout);
+        else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc &&
+                 (predictor = predictor_kind(argv[i + 1])) >= 0) i++;
+        else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) ras_depth = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) cache_spec = argv[++i];
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) limit = strtoull(argv[++i], NULL, 0);
+        else if (argv[i][0] != '-' && !path) path = argv[i];
+        else {
+            path = NULL;   // unknown option or a second image: print usage
+            break;
+        }
+    }
+    if (!path) {
+        printf("CMPE220 Program Runner\n");
+        printf("Usage: %s [-j] [-g] [-v] [-t] [-p] [-c] [-F] [-b predictor] [-R depth]\n"
+               "       [-C caches] [-r] [-n max_instr] program.bin\n", argv[0]);
+        printf("  -j  JIT    -g  reference ALU    -v  print every instruction\n");
+        printf("  -t  dump the last instructions at exit    -p  profile\n");
+        printf("  -c  pipeline timing (CPI, stalls)    -F  same, without forwarding\n");
+        printf("  -b  branch predictor: none, static, 2bit or gshare\n");
+        printf("  -R  return-address stack entries for -b (default 8, at most %d)\n", PREDICT_RAS_MAX);
+        printf("  -C  caches: default, or changes such as l1d=512/8/4/fifo,l2=off,memory=50\n");
+        printf("      (levels l1i, l1d, l2 as words/line/ways[/lru|fifo|random]; l2cycles)\n");
+        printf("  -r  print registers at exit    -n  stop after max_instr instructions\n");
+        return 1;
+    }
+    const char *bad = NULL;
+    if (cache_spec && strcmp(cache_spec, "default") != 0) bad = cache_configure(&caches, cache_spec);
+    if (bad) {
+        fprintf(stderr, "Error: -C %s: %s\n", cache_spec, bad);
+        return 1;
+    }
+
+    struct Image img;
+    const char *err = image_open(path, &img);
+    if (err) {
+        fprintf(stderr, "Error: '%s': %s\n", path, err);
+        return 1;
+    }
+
+    cpu_map_program(&cpu, img.words, img.size, img.load, img.entry);
+    if (verbose) cpu.on_step = trace_print_cycle;
+    if (tracing) trace_enable(&cpu);
+    if (timing) cpu.pipeline = pipeline_create(pipe, NULL);
+    if (predictor >= 0) cpu.predictor = predictor_create(predictor, ras_depth, NULL);
+    if (cache_spec) cpu.cache = cache_create(caches, NULL);
+
+    struct CPURunResult res = cpu_run(&cpu, limit);
+    console_flush(&cpu.console);
+
+    if (res.reason == CPU_STOP_FAULT) {
+        fprintf(stderr, "[CPU] %s (IP=%d)\n", cpu.fault, cpu.cu.IP);
+    } else if (res.reason == CPU_STOP_BUDGET) {
+        fprintf(stderr, "[CPU] Stopped after %llu instructions\n", (unsigned long long)res.cycles);
+    }
+    if (tracing) trace_dump(&cpu, stdout);
+    if (cache_spec) cache_report(&cpu, stdout);
+    if (predictor >= 0) predictor_report(&cpu, stdout);
+    if (timing) pipeline_report(&cpu, stdout);
+    if (registers) dump_registers(&cpu);
+
+    jit_destroy(cpu.jit);
+    profile_destroy(cpu.profile);
+    pipeline_destroy(cpu.pipeline);
+    predictor_destroy(cpu.predictor);
+    cache_destroy(cpu.cache);
+    cpu_release(&cpu);
+    console_close(&cpu.console);
+    image_close(&img);   // only after cpu_release: unwritten pages still point into it
+    return res.reason == CPU_STOP_HALT ? 0 : res.reason == CPU_STOP_FAULT ? 1 : 2;
+}
@@ -0,0 +1,150 @@
+// image.c
+// Reading and writing program image files.
+//
+// image_open maps the file read-only instead of reading it, so opening
+// costs the same for any image size and the words can be handed straight
+// to cpu_map_program, which shares whole pages with the mapping. Only the
+// checksum walks the words once.
+
+#if !defined(_WIN32) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE   // mmap under -std=c11
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "cpu.h"
+#include "image.h"
+
+uint32_t image_checksum(const uint16_t *words, size_t size) {
+    uint32_t a = 0xFFFF, b = 0xFFFF;
+
+    while (size > 0) {
+        size_t block = size < 359 ? size : 359;   // largest run whose sums fit 32 bits
+        size -= block;
+        while (block--) {
+            a += *words++;
+            b += a;
+        }
+        a = (a & 0xFFFF) + (a >> 16);
+        b = (b & 0xFFFF) + (b >> 16);
+    }
+    a = (a & 0xFFFF) + (a >> 16);
+    b = (b & 0xFFFF) + (b >> 16);
+    return b << 16 | a;
+}
+
+int image_write(FILE *out, const uint16_t *words, size_t size, uint16_t load, uint16_t entry) {
+    struct ImageHeader h = {
+        .magic = IMAGE_MAGIC,
+        .version = IMAGE_VERSION,
+        .entry = entry,
+        .load = load,
+        .size = (uint32_t)size,
+        .checksum = image_checksum(words, size),
+    };
+    return fwrite(&h, sizeof(h), 1, out) == 1 &&
+           fwrite(words, sizeof(uint16_t), size, out) == size;
+}
+
+// Map (or on Windows, read) the whole file
+static void *map_file(const char *path, size_t *len) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    void *map = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) map = NULL;
+        *len = (size_t)st.st_size;
+    }
+    close(fd);
+    return map;
+#else
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return NULL;
+
+    long n = fseek(fp, 0, SEEK_END) == 0 ? ftell(fp) : -1;
+    void *buf = n > 0 ? malloc((size_t)n) : NULL;
+    if (buf && (fseek(fp, 0, SEEK_SET) != 0 || fread(buf, 1, (size_t)n, fp) != (size_t)n)) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(fp);
+    *len = buf ? (size_t)n : 0;
+    return buf;
+#endif
+}
+
+static void unmap_file(void *map, size_t len) {
+#ifndef _WIN32
+    munmap(map, len);
+#else
+    (void)len;
+    free(map);
+#endif
+}
+
+static const char *check_header(const struct ImageHeader *h, size_t len) {
+    size_t words = (len - sizeof(*h)) / sizeof(word_t);
+
+    if (h->version != IMAGE_VERSION) return "unsupported image version";
+    if (h->size == 0) return "image is empty";
+    if (h->size > words) return "image is truncated";
+    if (h->size < words || (len - sizeof(*h)) % sizeof(word_t)) {
+        return "trailing bytes after the image";
+    }
+    if (h->load + h->size > ADDRESS_SPACE) return "image does not fit the address space";
+    if (h->entry < h->load || (uint32_t)(h->entry - h->load) >= h->size) {
+        return "entry point is outside the image";
+    }
+    return NULL;
+}
+
+const char *image_open(const char *path, struct Image *img) {
+    memset(img, 0, sizeof(*img));
+    img->map = map_file(path, &img->map_len);
+    if (img->map == NULL) return "cannot open or map the file";
+
+    const struct ImageHeader *h = img->map;
+    const char *err = NULL;
+
+    if (img->map_len >= sizeof(*h) && h->magic == IMAGE_MAGIC) {
+        err = check_header(h, img->map_len);
+        img->words = (const uint16_t *)(h + 1);
+        if (!err && image_checksum(img->words, h->size) != h->checksum) {
+            err = "checksum mismatch";
+        }
+        img->size = h->size;
+        img->load = h->load;
+        img->entry = h->entry;
+    } else if (img->map_len >= sizeof(*h) &&
+               h->magic == ((IMAGE_MAGIC >> 24) | (IMAGE_MAGIC >> 8 & 0xFF00) |
+                            (IMAGE_MAGIC << 8 & 0xFF0000) | (IMAGE_MAGIC << 24))) {
+        err = "image was written with the other byte order";
+    } else {
+        // Headerless: raw words at address 0
+        img->words = img->map;
+        img->size = img->map_len / sizeof(word_t);
+        if (img->map_len % sizeof(word_t) || img->size == 0 || img->size > ADDRESS_SPACE) {
+            err = "raw image must hold 1 to 65536 whole words";
+        }
+    }
+
+    if (err) image_close(img);
+    return err;
+}
+
+void image_close(struct Image *img) {
+    if (img->map) unmap_file(img->map, img->map_len);
+    memset(img, 0, sizeof(*img));
+}
@@ -0,0 +1,47 @@
+// image.h
+// Program image files (.bin) written by the assembler and linker (see image.c)
+//
+// A file is one struct ImageHeader followed by size host-order words,
+// which go to memory at load and onward. Files without the header (raw
+// words from older assemblers) are still read, loaded at address 0.
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define IMAGE_MAGIC   0x4D493243u   // "C2IM" on a little-endian host
+#define IMAGE_VERSION 1
+
+struct ImageHeader {
+    uint32_t magic;      // IMAGE_MAGIC; byte-swapped if written on another host
+    uint16_t version;    // IMAGE_VERSION
+    uint16_t entry;      // initial IP, inside the image
+    uint16_t load;       // address of the first word
+    uint16_t reserved;   // zero
+    uint32_t size;       // words after the header, load + size <= 65536
+    uint32_t checksum;   // image_checksum of those words
+};
+
+// An opened image; words point into a read-only mapping of the file
+struct Image {
+    const uint16_t *words;
+    size_t size;
+    uint16_t load, entry;
+    void *map;           // for image_close
+    size_t map_len;
+};
+
+// Fletcher-32 over the words
+uint32_t image_checksum(const uint16_t *words, size_t size);
+
+// Write a header and the words; returns 0 on a write error
+int image_write(FILE *out, const uint16_t *words, size_t size, uint16_t load, uint16_t entry);
+
+// Map path and check its header; returns NULL, or why the file was rejected
+const char *image_open(const char *path, struct Image *img);
+void image_close(struct Image *img);
+
+#endif
@@ -0,0 +1,570 @@
+// linker.c
+// Links relocatable objects from `assembler -c` into one program image.
+//
+// Object format (text, one record per line):
+//   CMPE220-OBJ 1
+//   word 0xHHHH [; comment]     instructions, in address order from 0
+//   label <name> <offset> local|global
+//   reloc <offset> <name>       the word's 6-bit immediate gets name's address;
+//                               a MOVW's immediate word gets all 16 bits
+//   end
+// A reloc name is looked up among the module's own labels first, then
+// among the global labels of every module.
+//
+// Each module is cut into routines at labels that follow a JMP, RET or
+// HALT, since no code falls through into them. Only routines reachable
+// from the entry through relocations are kept. The entry routine goes at
+// address 0, then hot routines, then the rest in call order. A routine is
+// hot if it contains a loop (a jump or conditional branch back into
+// itself), is named with -H, or is called from a hot routine. Hot code
+// therefore sits together at the low addresses, which are the only ones
+// a 6-bit jump or call target can reach.
+//
+// Usage: linker [-o out.bin] [-e entry] [-H name,...] [-M] module.o...
+// Build: gcc -std=c11 -O2 linker.c image.c -o linker
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "image.h"
+
+#define LINK_LINE_LENGTH 512
+#define LINK_IMM_LIMIT 64        // targets must fit the 6-bit immediate field
+
+struct Symbol {
+    char *name;
+    int module;
+    int offset;
+    int global;
+};
+
+struct Reloc {
+    int offset;
+    char *name;
+    int target;       // routine holding the target, -1 if unresolved
+    int target_offset;
+};
+
+struct Module {
+    const char *path;
+    word_t *code;
+    char *literal;           // word is the immediate of the MOVW before it
+    int size;
+    struct Symbol *labels;   // sorted by name
+    int label_count;
+    struct Reloc *relocs;    // sorted by offset
+    int reloc_count;
+    int first_routine, routine_count;
+};
+
+// A run of a module's code that is only entered through its labels
+struct Routine {
+    int module;
+    int start, end;          // word offsets in the module
+    int first_reloc, last_reloc;
+    int reachable, hot;
+    int order;               // discovery order from the entry
+    int address;             // in the linked image, -1 if stripped
+};
+
+struct Linker {
+    struct Module *modules;
+    int module_count;
+    struct Symbol *globals;  // sorted by name
+    int global_count;
+    struct Routine *routines;
+    int routine_count;
+    int errors;
+};
+
+static void *link_alloc(void *array, size_t count, size_t size) {
+    array = realloc(array, (count ? count : 1) * size);
+    if (!array) {
+        fprintf(stderr, "linker: out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static char *link_strdup(const char *s) {
+    return strcpy(link_alloc(NULL, strlen(s) + 1, 1), s);
+}
+
+static int symbol_cmp(const void *a, const void *b) {
+    return strcmp(((const struct Symbol *)a)->name, ((const struct Symbol *)b)->name);
+}
+
+static int reloc_cmp(const void *a, const void *b) {
+    return ((const struct Reloc *)a)->offset - ((const struct Reloc *)b)->offset;
+}
+
+static struct Symbol *symbol_find(struct Symbol *symbols, int count, const char *name) {
+    struct Symbol key = { (char *)name, 0, 0, 0 };
+    return bsearch(&key, symbols, count, sizeof(key), symbol_cmp);
+}
+
+/* ---------------- Reading objects ---------------- */
+
+static int read_object(struct Module *m, const char *path) {
+    FILE *fp = fopen(path, "r");
+    char line[LINK_LINE_LENGTH], name[LINK_LINE_LENGTH], kind[16];
+    int words_cap = 0, labels_cap = 0, relocs_cap = 0, line_number = 0, ended = 0;
+    unsigned value;
+    int offset;
+
+    memset(m, 0, sizeof(*m));
+    m->path = path;
+    if (!fp) {
+        fprintf(stderr, "linker: cannot open '%s'\n", path);
+        return 0;
+    }
+    if (!fgets(line, sizeof(line), fp) || strncmp(line, "CMPE220-OBJ 1", 13) != 0) {
+        fprintf(stderr, "linker: '%s' is not an object file\n", path);
+        fclose(fp);
+        return 0;
+    }
+    line_number = 1;
+
+    while (fgets(line, sizeof(line), fp)) {
+        line_number++;
+        // Skip the rest of an overlong line (a long source comment)
+        if (!strchr(line, '\n')) {
+            int c;
+            while ((c = fgetc(fp)) != EOF && c != '\n') {}
+        }
+
+        if (sscanf(line, "word %x", &value) == 1) {
+            if (m->size == words_cap) {
+                words_cap = words_cap ? words_cap * 2 : 64;
+                m->code = link_alloc(m->code, words_cap, sizeof(word_t));
+            }
+            m->code[m->size++] = (word_t)value;
+        } else if (sscanf(line, "label %511s %d %15s", name, &offset, kind) == 3) {
+            if (m->label_count == labels_cap) {
+                labels_cap = labels_cap ? labels_cap * 2 : 16;
+                m->labels = link_alloc(m->labels, labels_cap, sizeof(struct Symbol));
+            }
+            m->labels[m->label_count++] = (struct Symbol){
+                link_strdup(name), 0, offset, strcmp(kind, "global") == 0 };
+        } else if (sscanf(line, "reloc %d %511s", &offset, name) == 2) {
+            if (m->reloc_count == relocs_cap) {
+                relocs_cap = relocs_cap ? relocs_cap * 2 : 16;
+                m->relocs = link_alloc(m->relocs, relocs_cap, sizeof(struct Reloc));
+            }
+            m->relocs[m->reloc_count++] = (struct Reloc){ offset, link_strdup(name), -1, 0 };
+        } else if (strncmp(line, "end", 3) == 0) {
+            ended = 1;
+            break;
+        } else {
+            fprintf(stderr, "linker: %s:%d: bad record\n", path, line_number);
+            fclose(fp);
+            return 0;
+        }
+    }
+    fclose(fp);
+
+    if (!ended) {
+        fprintf(stderr, "linker: '%s' is truncated\n", path);
+        return 0;
+    }
+    for (int i = 0; i < m->reloc_count; i++) {
+        if (m->relocs[i].offset < 0 || m->relocs[i].offset >= m->size) {
+            fprintf(stderr, "linker: %s: relocation outside the code\n", path);
+            return 0;
+        }
+    }
+    m->literal = link_alloc(NULL, m->size, 1);
+    memset(m->literal, 0, m->size);
+    for (int o = 0; o < m->size; o += INSTR_WORDS(m->code[o])) {
+        if (INSTR_WORDS(m->code[o]) == 2 && o + 1 < m->size) m->literal[o + 1] = 1;
+    }
+    qsort(m->labels, m->label_count, sizeof(struct Symbol), symbol_cmp);
+    qsort(m->relocs, m->reloc_count, sizeof(struct Reloc), reloc_cmp);
+    return 1;
+}
+
+/* ---------------- Symbols and routines ---------------- */
+
+static void collect_globals(struct Linker *lk) {
+    int count = 0;
+
+    for (int m = 0; m < lk->module_count; m++) count += lk->modules[m].label_count;
+    lk->globals = link_alloc(NULL, count, sizeof(struct Symbol));
+    for (int m = 0; m < lk->module_count; m++) {
+        struct Module *mod = &lk->modules[m];
+        for (int i = 0; i < mod->label_count; i++) {
+            mod->labels[i].module = m;
+            if (mod->labels[i].global) lk->globals[lk->global_count++] = mod->labels[i];
+        }
+    }
+    qsort(lk->globals, lk->global_count, sizeof(struct Symbol), symbol_cmp);
+    for (int i = 1; i < lk->global_count; i++) {
+        if (strcmp(lk->globals[i - 1].name, lk->globals[i].name) == 0) {
+            fprintf(stderr, "linker: '%s' is exported by both %s and %s\n", lk->globals[i].name,
+                    lk->modules[lk->globals[i - 1].module].path,
+                    lk->modules[lk->globals[i].module].path);
+            lk->errors++;
+        }
+    }
+}
+
+// Label name as seen from module m: its own labels, then the globals
+static struct Symbol *resolve(struct Linker *lk, int m, const char *name) {
+    struct Module *mod = &lk->modules[m];
+    struct Symbol *s = symbol_find(mod->labels, mod->label_count, name);
+    return s ? s : symbol_find(lk->globals, lk->global_count, name);
+}
+
+static int is_terminator(word_t w) {
+    int op = (w >> 12) & 0xF;
+    return op == JMP || op == RET || op == HALT;
+}
+
+static void split_routines(struct Linker *lk) {
+    int total = 0;
+
+    for (int m = 0; m < lk->module_count; m++) total += lk->modules[m].size + 1;
+    lk->routines = link_alloc(NULL, total, sizeof(struct Routine));
+
+    for (int m = 0; m < lk->module_count; m++) {
+        struct Module *mod = &lk->modules[m];
+        char *starts = link_alloc(NULL, mod->size + 1, 1);
+
+        memset(starts, 0, mod->size + 1);
+        starts[0] = 1;
+        for (int i = 0; i < mod->label_count; i++) {
+            int o = mod->labels[i].offset;
+            if (o > 0 && o < mod->size && !mod->literal[o - 1] &&
+                is_terminator(mod->code[o - 1])) starts[o] = 1;
+        }
+
+        mod->first_routine = lk->routine_count;
+        int r = 0;
+        for (int o = 0; o < mod->size; o++) {
+            if (!starts[o]) continue;
+            int end = o + 1, first = r;
+            while (end < mod->size && !starts[end]) end++;
+            while (r < mod->reloc_count && mod->relocs[r].offset < end) r++;
+            lk->routines[lk->routine_count++] = (struct Routine){
+                m, o, end, first, r, 0, 0, -1, -1 };
+        }
+        mod->routine_count = lk->routine_count - mod->first_routine;
+        free(starts);
+    }
+}
+
+// Routine of module m holding offset, or -1
+static int routine_at(struct Linker *lk, int m, int offset) {
+    struct Module *mod = &lk->modules[m];
+    int lo = mod->first_routine, hi = lo + mod->routine_count - 1;
+
+    if (offset < 0 || offset >= mod->size) return -1;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (lk->routines[mid].start <= offset) lo = mid;
+        else hi = mid - 1;
+    }
+    return lo;
+}
+
+static void resolve_relocs(struct Linker *lk) {
+    for (int m = 0; m < lk->module_count; m++) {
+        struct Module *mod = &lk->modules[m];
+        for (int i = 0; i < mod->reloc_count; i++) {
+            struct Reloc *rel = &mod->relocs[i];
+            struct Symbol *s = resolve(lk, m, rel->name);
+            if (!s) {
+                fprintf(stderr, "linker: %s: undefined label '%s'\n", mod->path, rel->name);
+                lk->errors++;
+                continue;
+            }
+            rel->target = routine_at(lk, s->module, s->offset);
+            rel->target_offset = s->offset;
+            if (rel->target < 0) {
+                fprintf(stderr, "linker: %s: label '%s' is past the end of its code\n",
+                        mod->path, rel->name);
+                lk->errors++;
+            }
+        }
+    }
+}
+
+/* ---------------- Reachability and layout ---------------- */
+
+// Depth-first walk from the entry; order records first visits
+static int mark_reachable(struct Linker *lk, int entry) {
+    int *stack = link_alloc(NULL, lk->routine_count, sizeof(int));
+    int *next = link_alloc(NULL, lk->routine_count, sizeof(int));
+    int depth = 0, order = 0;
+
+    stack[depth++] = entry;
+    lk->routines[entry].reachable = 1;
+    lk->routines[entry].order = order++;
+    next[entry] = lk->routines[entry].first_reloc;
+
+    while (depth) {
+        struct Routine *r = &lk->routines[stack[depth - 1]];
+        struct Module *mod = &lk->modules[r->module];
+        int *i = &next[stack[depth - 1]];
+
+        if (*i == r->last_reloc) {
+            depth--;
+            continue;
+        }
+        int t = mod->relocs[(*i)++].target;
+        if (t < 0 || lk->routines[t].reachable) continue;
+        lk->routines[t].reachable = 1;
+        lk->routines[t].order = order++;
+        next[t] = lk->routines[t].first_reloc;
+        stack[depth++] = t;
+    }
+    free(stack);
+    free(next);
+    return order;
+}
+
+static void mark_hot(struct Linker *lk) {
+    int changed = 1;
+
+    // Loops: a JMP or conditional branch (JZ opcode) back to an earlier
+    // word of the same routine
+    for (int c = 0; c < lk->routine_count; c++) {
+        struct Routine *r = &lk->routines[c];
+        struct Module *mod = &lk->modules[r->module];
+        for (int i = r->first_reloc; i < r->last_reloc; i++) {
+            struct Reloc *rel = &mod->relocs[i];
+            int op = (mod->code[rel->offset] >> 12) & 0xF;
+            if ((op == JMP || op == JZ) && rel->target == c && rel->target_offset <= rel->offset) {
+                r->hot = 1;
+            }
+        }
+    }
+
+    // Everything a hot routine calls runs as often as the caller
+    while (changed) {
+        changed = 0;
+        for (int c = 0; c < lk->routine_count; c++) {
+            struct Routine *r = &lk->routines[c];
+            struct Module *mod = &lk->modules[r->module];
+            if (!r->hot || !r->reachable) continue;
+            for (int i = r->first_reloc; i < r->last_reloc; i++) {
+                struct Reloc *rel = &mod->relocs[i];
+                int op = (mod->code[rel->offset] >> 12) & 0xF;
+                if (op == CALL && rel->target >= 0 && !lk->routines[rel->target].hot) {
+                    lk->routines[rel->target].hot = 1;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+// Routines in image order: the entry, the -H routines, other hot
+// routines, then the rest, each group in discovery order
+static int layout(struct Linker *lk, int entry, const int *pinned, int pinned_count,
+                  int reachable, int *sequence) {
+    int *by_order = link_alloc(NULL, reachable, sizeof(int));
+    int n = 0, address = 0;
+
+    for (int c = 0; c < lk->routine_count; c++) {
+        if (lk->routines[c].reachable) by_order[lk->routines[c].order] = c;
+    }
+
+    sequence[n++] = entry;
+    lk->routines[entry].address = 0;
+    for (int i = 0; i < pinned_count; i++) {
+        int c = pinned[i];
+        if (!lk->routines[c].reachable || lk->routines[c].address >= 0) continue;
+        sequence[n++] = c;
+        lk->routines[c].address = 0;
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < reachable; i++) {
+            int c = by_order[i];
+            if (lk->routines[c].address >= 0 || lk->routines[c].hot != !pass) continue;
+            sequence[n++] = c;
+            lk->routines[c].address = 0;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        struct Routine *r = &lk->routines[sequence[i]];
+        r->address = address;
+        address += r->end - r->start;
+    }
+    free(by_order);
+    return address;
+}
+
+static void apply_relocs(struct Linker *lk, const int *sequence, int count, word_t *image) {
+    for (int s = 0; s < count; s++) {
+        struct Routine *r = &lk->routines[sequence[s]];
+        struct Module *mod = &lk->modules[r->module];
+
+        memcpy(image + r->address, mod->code + r->start, (r->end - r->start) * sizeof(word_t));
+        for (int i = r->first_reloc; i < r->last_reloc; i++) {
+            struct Reloc *rel = &mod->relocs[i];
+            struct Routine *t;
+            int address;
+
+            if (rel->target < 0) continue;
+            t = &lk->routines[rel->target];
+            address = t->address + rel->target_offset - t->start;
+            if (mod->literal[rel->offset]) {
+                image[r->address + rel->offset - r->start] = (word_t)address;
+                continue;
+            }
+            if (address >= LINK_IMM_LIMIT) {
+                fprintf(stderr, "linker: %s: '%s' lands at address %d, beyond the "
+                        "6-bit immediate field (0-%d)%s\n", mod->path, rel->name, address,
+                        LINK_IMM_LIMIT - 1, ((mod->code[rel->offset] >> 12) & 0xF) == MOV ?
+                        "; MOVW takes any address" : "");
+                lk->errors++;
+                continue;
+            }
+            image[r->address + rel->offset - r->start] |= (word_t)address;
+        }
+    }
+}
+
+// First label of a routine's start, for the map
+static const char *routine_name(struct Linker *lk, const struct Routine *r) {
+    struct Module *mod = &lk->modules[r->module];
+    for (int i = 0; i < mod->label_count; i++) {
+        if (mod->labels[i].offset == r->start) return mod->labels[i].name;
+    }
+    return "(start)";
+}
+
+static void print_map(struct Linker *lk, const int *sequence, int count) {
+    printf("  Map:\n");
+    for (int s = 0; s < count; s++) {
+        struct Routine *r = &lk->routines[sequence[s]];
+        printf("    %4d  %-20s %4d words  %s%s\n", r->address, routine_name(lk, r),
+               r->end - r->start, lk->modules[r->module].path, r->hot ? "  (hot)" : "");
+    }
+    for (int c = 0; c < lk->routine_count; c++) {
+        struct Routine *r = &lk->routines[c];
+        if (r->reachable) continue;
+        printf("       -  %-20s %4d words  %s  (stripped)\n", routine_name(lk, r),
+               r->end - r->start, lk->modules[r->module].path);
+    }
+}
+
+/* ---------------- Main ---------------- */
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-o out.bin] [-e entry] [-H name,...] [-M] module.o...\n"
+            "  -o  output image (default program.bin)\n"
+            "  -e  entry label, placed at address 0 (default: global 'main' if\n"
+            "      any module exports it, else the start of the first module)\n"
+            "  -H  routines to place first, in this order, after the entry\n"
+            "  -M  print the link map\n",
+            prog);
+}
+
+int main(int argc, char *argv[]) {
+    struct Linker lk = { 0 };
+    const char *output = "program.bin";
+    const char *entry_name = NULL;
+    char *hot_names = NULL;
+    int show_map = 0, arg = 1;
+
+    for (; arg < argc && argv[arg][0] == '-'; arg++) {
+        if (strcmp(argv[arg], "-M") == 0) {
+            show_map = 1;
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-o") == 0) {
+            output = argv[++arg];
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-e") == 0) {
+            entry_name = argv[++arg];
+        } else if (arg + 1 < argc && strcmp(argv[arg], "-H") == 0) {
+            hot_names = argv[++arg];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (arg >= argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    lk.module_count = argc - arg;
+    lk.modules = link_alloc(NULL, lk.module_count, sizeof(struct Module));
+    for (int m = 0; m < lk.module_count; m++) {
+        if (!read_object(&lk.modules[m], argv[arg + m])) return 1;
+    }
+    collect_globals(&lk);
+    split_routines(&lk);
+    resolve_relocs(&lk);
+
+    // Entry routine
+    int entry = -1;
+    struct Symbol *s = symbol_find(lk.globals, lk.global_count, entry_name ? entry_name : "main");
+    if (s) {
+        entry = routine_at(&lk, s->module, s->offset);
+        if (entry >= 0 && lk.routines[entry].start != s->offset) {
+            fprintf(stderr, "linker: entry '%s' does not start a routine (it must follow "
+                    "JMP, RET or HALT, or begin its module)\n", s->name);
+            return 1;
+        }
+    } else if (entry_name) {
+        fprintf(stderr, "linker: entry '%s' is not an exported label\n", entry_name);
+        return 1;
+    } else {
+        entry = routine_at(&lk, 0, 0);
+    }
+    if (entry < 0) {
+        fprintf(stderr, "linker: nothing to link\n");
+        return 1;
+    }
+
+    // Routines named with -H
+    int *pinned = link_alloc(NULL, lk.routine_count, sizeof(int));
+    int pinned_count = 0;
+    for (char *name = hot_names ? strtok(hot_names, ",") : NULL; name; name = strtok(NULL, ",")) {
+        struct Symbol *h = symbol_find(lk.globals, lk.global_count, name);
+        int c = h ? routine_at(&lk, h->module, h->offset) : -1;
+        if (c < 0) {
+            fprintf(stderr, "linker: -H: '%s' is not an exported label\n", name);
+            return 1;
+        }
+        lk.routines[c].hot = 1;
+        pinned[pinned_count++] = c;
+    }
+    if (lk.errors) return 1;
+
+    int reachable = mark_reachable(&lk, entry);
+    mark_hot(&lk);
+    int *sequence = link_alloc(NULL, reachable, sizeof(int));
+    int size = layout(&lk, entry, pinned, pinned_count, reachable, sequence);
+    if (size > CODE_SIZE) {
+        fprintf(stderr, "linker: image is %d words; code must fit in %d\n", size, CODE_SIZE);
+        return 1;
+    }
+    word_t *image = link_alloc(NULL, size, sizeof(word_t));
+    apply_relocs(&lk, sequence, reachable, image);
+    if (lk.errors) return 1;
+
+    FILE *out = fopen(output, "wb");
+    if (!out) {
+        fprintf(stderr, "linker: cannot open output file '%s'\n", output);
+        return 1;
+    }
+    if (!image_write(out, image, size, 0, 0)) {
+        fprintf(stderr, "linker: cannot write output file '%s'\n", output);
+        return 1;
+    }
+    fclose(out);
+
+    int total = 0;
+    for (int m = 0; m < lk.module_count; m++) total += lk.modules[m].size;
+    printf("CMPE220 Linker - %d module(s), %d routine(s)\n", lk.module_count, lk.routine_count);
+    printf("  Kept %d routine(s), stripped %d (%d of %d words)\n", reachable,
+           lk.routine_count - reachable, total - size, total);
+    if (show_map) print_map(&lk, sequence, reachable);
+    printf("  Image written to '%s' (%d words)\n", output, size);
+    return 0;
+}
@@ -0,0 +1,323 @@
+// lockstep.c
+// Runs up to LANES CPU instances in lockstep, structure-of-arrays style.
+//
+// All lanes of a group run the same program and share one IP, so each
+// instruction is fetched and decoded once and executed as lane-wise
+// vector operations: word_t x 16 fills one 256-bit AVX2 register. The
+// vectors use GCC vector extensions, so building with -mavx2 (or
+// -march=native) turns them into AVX2 code; other hosts get SSE/NEON or
+// scalar code from the same source.
+//
+// A lane leaves the group ("is ejected") as a plain struct CPU that the
+// scalar core finishes:
+//   - a conditional branch splits the group: the smaller side is ejected
+//     at its next IP
+//   - a fetch or RET target that differs between lanes ejects the group
+//   - HALT, DIV by zero and stack faults eject the lanes before the
+//     instruction, so the scalar core reports them exactly as usual
+//   - lanes only hold the first CODE_SIZE words, so a LOAD or STORE
+//     above them ejects the group to the scalar core's paged memory
+//
+// Build with: gcc -std=c11 -O2 -mavx2 ... lockstep.c cpu.c
+
+#include <string.h>
+
+#include "lockstep.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+typedef uint32_t lane_wide __attribute__((vector_size(LANES * sizeof(uint32_t))));
+
+/* ---------------- Lane masks ---------------- */
+
+// Vectors are passed by pointer: by value they would change the calling
+// convention depending on whether AVX is enabled.
+
+// One bit per lane of a lane mask (bit l set: lane l is all-ones)
+static uint32_t lane_bits(const lane_mask *m) {
+#ifdef __AVX2__
+    __m256i v;
+    memcpy(&v, m, sizeof(v));
+    // packs keeps 128-bit halves apart: lanes 0-7 land in bytes 0-7, 8-15 in 16-23
+    uint32_t bytes = (uint32_t)_mm256_movemask_epi8(_mm256_packs_epi16(v, _mm256_setzero_si256()));
+    return (bytes & 0xFF) | ((bytes >> 8) & 0xFF00);
+#else
+    uint32_t bits = 0;
+    for (int l = 0; l < LANES; l++) bits |= (uint32_t)((*m)[l] != 0) << l;
+    return bits;
+#endif
+}
+
+static int first_lane(uint32_t active) {
+    return __builtin_ctz(active);
+}
+
+// Lanes of active where v differs from the first active lane's value
+static uint32_t lanes_differing(const lane_vec *v, uint32_t active) {
+    lane_mask same = *v == (*v)[first_lane(active)];
+    return ~lane_bits(&same) & active;
+}
+
+/* ---------------- Entering and leaving the group ---------------- */
+
+void lockstep_init(struct Lockstep *g) {
+    memset(g, 0, sizeof(*g));
+    g->SP = 399;
+}
+
+int lockstep_set_lane(struct Lockstep *g, int l, const struct CPU *cpu) {
+    int first_page = (CODE_SIZE + PAGE_WORDS - 1) >> PAGE_SHIFT;
+
+    for (int a = CODE_SIZE; a < first_page * PAGE_WORDS; a++) {
+        if (cpu_peek(cpu, (word_t)a)) return 0;
+    }
+    for (int p = first_page; p < PAGE_COUNT; p++) {
+        if (cpu_page_mapped(cpu, p)) return 0;
+    }
+
+    for (int a = 0; a < CODE_SIZE; a++) g->mem[a][l] = cpu_peek(cpu, (word_t)a);
+    for (int r = 0; r < 8; r++) g->reg[r][l] = cpu->gpr.reg[r];
+    g->zr[l] = cpu->cu.aluflags.zr ? 0xFFFF : 0;
+    g->ng[l] = cpu->cu.aluflags.ng ? 0xFFFF : 0;
+    g->ov[l] = cpu->cu.aluflags.ov ? 0xFFFF : 0;
+    g->cy[l] = cpu->cu.aluflags.cy ? 0xFFFF : 0;
+    g->console[l] = cpu->console;
+    g->IP = cpu->cu.IP;
+    g->IR = cpu->cu.IR;
+    g->SP = cpu->spr.SP;
+    g->static_counter = cpu->static_counter;
+    g->active |= 1u << l;
+    return 1;
+}
+
+// Rebuild lane l as a scalar CPU resuming at ip and hand it to eject
+static void lockstep_eject(struct Lockstep *g, int l, word_t ip, struct CPU *cpu,
+                           lockstep_eject_fn eject, void *ctx) {
+    struct JIT *jit = cpu->jit;
+    word_t image[CODE_SIZE];
+
+    for (int a = 0; a < CODE_SIZE; a++) image[a] = g->mem[a][l];
+    cpu_release(cpu);
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->jit = jit;
+    cpu_load_program(cpu, image, CODE_SIZE, 0);
+    cpu->cu.IP = ip;
+    for (int r = 0; r < 8; r++) cpu->gpr.reg[r] = g->reg[r][l];
+    alu_set_control(&cpu->cu.aluflags, g->alu_d);
+    cpu->cu.aluflags.zr = g->zr[l] != 0;
+    cpu->cu.aluflags.ng = g->ng[l] != 0;
+    cpu->cu.aluflags.ov = g->ov[l] != 0;
+    cpu->cu.aluflags.cy = g->cy[l] != 0;
+    cpu->cu.IR = g->IR;
+    cpu->spr.SP = g->SP;
+    cpu->static_counter = g->static_counter;
+    cpu->console = g->console[l];
+
+    g->console[l].capture = NULL;
+    g->console[l].len = 0;
+    g->active &= ~(1u << l);
+    eject(ctx, l, cpu, g->executed);
+}
+
+static void lockstep_eject_mask(struct Lockstep *g, uint32_t lanes, word_t ip, struct CPU *cpu,
+                                lockstep_eject_fn eject, void *ctx) {
+    for (int l = 0; l < LANES; l++) {
+        if (lanes & (1u << l)) lockstep_eject(g, l, ip, cpu, eject, ctx);
+    }
+}
+
+/* ---------------- Lane-wise ALU ---------------- */
+
+// *dst = *dst op *src with the results and flags of alu_exec's fast ALU
+static void lockstep_alu(struct Lockstep *g, uint8_t d, lane_vec *dst, const lane_vec *src) {
+    lane_vec x = *dst, y = *src, out, zero = {0};
+
+    g->alu_d = d;
+    g->cy = g->ov = zero;
+    switch (d) {
+    case ALU_ADD:
+        out = x + y;
+        g->cy = (lane_vec)(out < x);
+        g->ov = (lane_vec)((lane_mask)((x ^ out) & (y ^ out)) >> 15);
+        break;
+    case ALU_SUB:
+        out = x - y;
+        g->cy = (lane_vec)(x < y);
+        g->ov = (lane_vec)((lane_mask)((x ^ y) & (x ^ out)) >> 15);
+        break;
+    case ALU_AND:
+        out = x & y;
+        break;
+    case ALU_OR:
+        out = x | y;
+        break;
+    case ALU_MUL: {
+        lane_wide prod = __builtin_convertvector(x, lane_wide) * __builtin_convertvector(y, lane_wide);
+        out = __builtin_convertvector(prod, lane_vec);
+        g->cy = g->ov = __builtin_convertvector((prod >> 16) != 0, lane_vec);
+        break;
+    }
+    case ALU_DIV:
+        // No vector integer divide; DIV by zero lanes were ejected already
+        for (int l = 0; l < LANES; l++) out[l] = y[l] ? (word_t)(x[l] / y[l]) : 0;
+        break;
+    default:
+        out = zero;
+        break;
+    }
+    g->zr = (lane_vec)(out == 0);
+    g->ng = (lane_vec)((lane_mask)out >> 15);
+    *dst = out;
+}
+
+// Lanes of the group that take a conditional branch with cond
+static uint32_t lockstep_taken(const struct Lockstep *g, uint8_t cond) {
+    const lane_vec *flag = cond == COND_N || cond == COND_NN ? &g->ng :
+                           cond == COND_C || cond == COND_NC ? &g->cy :
+                           cond == COND_O ? &g->ov : &g->zr;
+    uint32_t set = lane_bits((const lane_mask *)flag);
+    int on_set = cond == COND_Z || cond == COND_N || cond == COND_C || cond == COND_O;
+    return (on_set ? set : ~set) & g->active;
+}
+
+/* ---------------- Run loop ---------------- */
+
+void lockstep_run(struct Lockstep *g, uint64_t limit, struct CPU *cpu,
+                  lockstep_eject_fn eject, void *ctx) {
+    while (g->active) {
+        word_t ip = g->IP;
+
+        if (g->executed >= limit || ip >= CODE_SIZE) {
+            lockstep_eject_mask(g, g->active, ip, cpu, eject, ctx);
+            break;
+        }
+
+        // Lanes only share a decode while their code is identical
+        if (lanes_differing(&g->mem[ip], g->active)) {
+            lockstep_eject_mask(g, g->active, ip, cpu, eject, ctx);
+            break;
+        }
+        word_t instr = g->mem[ip][first_lane(g->active)];
+        uint8_t op  = (instr >> 12) & 0xF;
+        uint8_t r1  = (instr >> 9)  & 0x7;
+        uint8_t r2  = (instr >> 6)  & 0x7;
+        uint8_t imm = instr & 0x3F;
+        lane_vec k  = IS_REG_FORM(instr) ? g->reg[imm & 0x7] : (lane_vec){0} + imm;
+
+        // Instructions that stop or fault some lanes go to the scalar core
+        if (op == HALT || (op == CALL && g->SP == 0) || (op == RET && g->SP >= 399)) {
+            lockstep_eject_mask(g, g->active, ip, cpu, eject, ctx);
+            break;
+        }
+        if (op == DIV) {
+            lane_mask zero = g->reg[r2] == 0;
+            uint32_t by_zero = lane_bits(&zero) & g->active;
+            lockstep_eject_mask(g, by_zero, ip, cpu, eject, ctx);
+            if (!g->active) break;
+        }
+        if (op == RET && lanes_differing(&g->mem[g->SP + 1], g->active)) {
+            lockstep_eject_mask(g, g->active, ip, cpu, eject, ctx);
+            break;
+        }
+        if (op == MOVW && (ip + 1 >= CODE_SIZE ||
+                           lanes_differing(&g->mem[ip + 1], g->active))) {
+            lockstep_eject_mask(g, g->active, ip, cpu, eject, ctx);
+            break;
+        }
+        if (op == LOAD || op == STORE) {
+            lane_mask outside = g->reg[r2] >= CODE_SIZE;
+            if (lane_bits(&outside) & g->active) {
+                lockstep_eject_mask(g, g->active, ip, cpu, eject, ctx);
+                break;
+            }
+        }
+
+        g->IR = instr;
+        g->IP = ip + 1;
+        g->executed++;
+
+        switch (op) {
+        case MOV: g->reg[r1] = k; break;
+        case MOVW:
+            g->reg[r1] = (lane_vec){0} + g->mem[ip + 1][first_lane(g->active)];
+            g->IP = ip + 2;
+            break;
+        case ADD: lockstep_alu(g, ALU_ADD, &g->reg[r1], &k); break;
+        case SUB:
+            if (IS_CMP(instr)) {
+                lane_vec discard = g->reg[r1];
+                lockstep_alu(g, ALU_SUB, &discard, &k);
+            } else {
+                lockstep_alu(g, ALU_SUB, &g->reg[r1], &k);
+            }
+            break;
+        case AND: lockstep_alu(g, ALU_AND, &g->reg[r1], &g->reg[r2]); break;
+        case OR:  lockstep_alu(g, ALU_OR,  &g->reg[r1], &g->reg[r2]); break;
+        case MUL: lockstep_alu(g, ALU_MUL, &g->reg[r1], &g->reg[r2]); break;
+        case DIV: lockstep_alu(g, ALU_DIV, &g->reg[r1], &g->reg[r2]); break;
+        case JMP: g->IP = imm; break;
+        case JZ: {
+            if (r2 == COND_DJNZ) {
+                lane_vec one = (lane_vec){0} + 1;
+                lockstep_alu(g, ALU_SUB, &g->reg[r1], &one);
+            }
+            uint32_t taken = lockstep_taken(g, r2);
+            if (taken == g->active) {
+                g->IP = imm;
+            } else if (taken) {
+                // Divergence: the larger side stays, the other finishes alone
+                uint32_t fall = g->active & ~taken;
+                if (__builtin_popcount(taken) > __builtin_popcount(fall)) {
+                    lockstep_eject_mask(g, fall, g->IP, cpu, eject, ctx);
+                    g->IP = imm;
+                } else {
+                    lockstep_eject_mask(g, taken, imm, cpu, eject, ctx);
+                }
+            }
+            break;
+        }
+        case CALL:
+            g->mem[g->SP] = (lane_vec){0} + g->IP;
+            g->SP--;
+            g->IP = imm;
+            g->static_counter++;
+            break;
+        case RET:
+            g->IP = g->mem[++g->SP][first_lane(g->active)];
+            g->static_counter--;
+            break;
+        case LOAD: {
+            lane_vec addr = g->reg[r2];
+            if (!lanes_differing(&addr, g->active)) {
+                g->reg[r1] = g->mem[addr[first_lane(g->active)]];
+            } else {
+                // Lanes outside the group may hold any address; they read word 0
+                for (int l = 0; l < LANES; l++) {
+                    g->reg[r1][l] = g->mem[addr[l] < CODE_SIZE ? addr[l] : 0][l];
+                }
+            }
+            break;
+        }
+        case STORE: {
+            lane_vec addr = g->reg[r2], value = g->reg[r1];
+            word_t a = addr[first_lane(g->active)];
+            if (!lanes_differing(&addr, g->active) &&
+                a != MMIO_CHAR_OUT && a != MMIO_FLUSH) {
+                g->mem[a] = value;   // lanes outside the group are dead, so no blend
+                break;
+            }
+            for (int l = 0; l < LANES; l++) {
+                if (!(g->active & (1u << l))) continue;
+                if (addr[l] == MMIO_CHAR_OUT) console_putc(&g->console[l], (char)(value[l] & 0xFF));
+                else if (addr[l] == MMIO_FLUSH) console_flush(&g->console[l]);
+                g->mem[addr[l]][l] = value[l];
+            }
+            break;
+        }
+        default:   // NOP
+            break;
+        }
+    }
+}
@@ -0,0 +1,43 @@
+// lockstep.h
+// SIMD lockstep groups of CPU instances (see lockstep.c)
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include "cpu.h"
+
+#define LANES 16
+
+typedef word_t lane_vec __attribute__((vector_size(LANES * sizeof(word_t))));
+typedef int16_t lane_mask __attribute__((vector_size(LANES * sizeof(int16_t))));
+
+// Flags are kept as all-ones / all-zeros lane masks
+struct Lockstep {
+    lane_vec mem[CODE_SIZE];             // lanes hold only the code window
+    lane_vec reg[8];
+    lane_vec zr, ng, ov, cy;
+    word_t IP, IR, SP, static_counter;   // uniform across the group
+    uint8_t alu_d;                       // last ALU control word, uniform
+    uint32_t active;                     // bit l set: lane l still in the group
+    uint64_t executed;                   // instructions run by the group
+    struct Console console[LANES];
+};
+
+// Called with each lane as it leaves the group; cpu holds its full state
+typedef void (*lockstep_eject_fn)(void *ctx, int lane, struct CPU *cpu, uint64_t executed);
+
+// Start an empty group; lanes are added with lockstep_set_lane
+void lockstep_init(struct Lockstep *g);
+
+// Copy a freshly loaded CPU into lane l. Every lane must start at the same
+// IP and SP; the console settings are taken from the CPU. Returns 0, and
+// leaves the group alone, if the CPU has data above CODE_SIZE.
+int lockstep_set_lane(struct Lockstep *g, int l, const struct CPU *cpu);
+
+// Run the group until every lane has been ejected; lanes still running
+// after limit instructions are ejected at their current IP. cpu is scratch
+// space for the ejected lanes (its JIT, if any, is kept).
+void lockstep_run(struct Lockstep *g, uint64_t limit, struct CPU *cpu,
+                  lockstep_eject_fn eject, void *ctx);
+
+#endif /* LOCKSTEP_H */
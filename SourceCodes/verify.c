@@ -0,0 +1,461 @@
+// verify.c
+// Differential verification: runs a program on two execution backends side
+// by side and finds the first instruction on which they disagree.
+//
+// Both CPUs advance -N instructions at a time and are compared through
+// cpu_state_hash and their console output. On a mismatch both are replayed
+// to the last point where they agreed and snapshotted there; the interval
+// is then bisected by restoring and re-running, down to the one instruction
+// whose result differs. That instruction is printed together with every
+// register, flag and memory word that came out different. A difference
+// that appears and disappears again within one interval goes unnoticed, so
+// a smaller -N checks more closely at some cost in speed.
+//
+// Backends:
+//   reference  cpu_step on the gate-level reference ALU (default for -a)
+//   step       cpu_step: predecoded, fast ALU, no fusion
+//   interp     cpu_run with superinstructions
+//   jit        x86-64 compiled tier (skipped elsewhere)
+//   lockstep   a SIMD lane group (lockstep.c); what it ejects finishes on interp
+//
+// With -R seed, -c random programs are generated instead of reading images:
+// random register values, then random instructions of every kind, with
+// stores that often land in the code and on the I/O ports.
+//
+// Usage: verify [-a backend] [-b backend,...] [-N interval] [-n max_instr]
+//               [-R seed] [-c count] [program.bin...]
+// Build: gcc -std=c11 -O2 -mavx2 verify.c lockstep.c image.c cpu.c -o verify
+//
+// Exit status: 0 if every pair agreed, 1 on a divergence or bad input.
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+#include "image.h"
+#include "lockstep.h"
+
+#define VERIFY_DEFAULT_INTERVAL 1000
+#define VERIFY_DEFAULT_LIMIT 100000000ULL   // instructions before a run is cut off
+#define VERIFY_RANDOM_LIMIT 100000ULL       // default -n for random programs
+#define VERIFY_RANDOM_WORDS 64              // random code stays within jump reach
+#define VERIFY_MAX_WORDS 8                  // differing memory words listed
+
+/* ---------------- Backends ---------------- */
+
+enum { BACKEND_REFERENCE, BACKEND_STEP, BACKEND_INTERP, BACKEND_JIT, BACKEND_LOCKSTEP,
+       BACKEND_COUNT };
+
+static const char *BACKEND_NAMES[BACKEND_COUNT] = {
+    "reference", "step", "interp", "jit", "lockstep"
+};
+
+// One side of a comparison
+struct Side {
+    int backend;
+    struct CPU cpu;
+    struct CPUSnapshot snap;   // where the bisection restarts from
+    size_t snap_output;        // console output captured at snap
+};
+
+struct Verify {
+    uint64_t interval;
+    uint64_t limit;
+    int random;                // programs are generated, not read
+};
+
+static struct Lockstep group;   // scratch group of the lockstep backend
+
+// Returns 0 if backend is not available on this host
+static int side_init(struct Side *s, int backend) {
+    memset(s, 0, sizeof(*s));
+    s->backend = backend;
+    if (backend == BACKEND_REFERENCE) s->cpu.alu_mode = ALU_REFERENCE;
+    if (backend == BACKEND_JIT && (s->cpu.jit = jit_create()) == NULL) return 0;
+    return 1;
+}
+
+static void side_free(struct Side *s) {
+    jit_destroy(s->cpu.jit);
+    cpu_release(&s->cpu);
+    console_close(&s->cpu.console);
+}
+
+// Load img afresh with its console output captured
+static void side_load(struct Side *s, const struct Image *img) {
+    cpu_reset(&s->cpu);
+    console_close(&s->cpu.console);
+    console_open(&s->cpu.console, CONSOLE_CAPTURE, NULL, 0);
+    cpu_map_program(&s->cpu, img->words, img->size, img->load, img->entry);
+}
+
+static void on_eject(void *ctx, int lane, struct CPU *cpu, uint64_t executed) {
+    (void)lane;
+    (void)cpu;
+    *(uint64_t *)ctx = executed;
+}
+
+// Run n instructions, fewer if the CPU stops; returns how many ran
+static uint64_t side_advance(struct Side *s, uint64_t n) {
+    struct CPU *cpu = &s->cpu;
+    uint64_t done = 0;
+
+    switch (s->backend) {
+    case BACKEND_REFERENCE:
+    case BACKEND_STEP:
+        while (done < n && cpu_step(cpu)) done++;
+        return done;
+    case BACKEND_LOCKSTEP:
+        // A one-lane group; lockstep_run rebuilds cpu when it ejects the lane
+        lockstep_init(&group);
+        if (cpu->running && lockstep_set_lane(&group, 0, cpu)) {
+            lockstep_run(&group, n, cpu, on_eject, &done);
+        }
+        return done + cpu_run(cpu, n - done).cycles;
+    default:
+        return cpu_run(cpu, n).cycles;
+    }
+}
+
+// Keep the state to bisect from; cpu_snapshot flushes the console first
+static void side_save(struct Side *s) {
+    cpu_snapshot(&s->cpu, &s->snap);
+    s->snap_output = s->cpu.console.capture_len;
+}
+
+static void side_rewind(struct Side *s) {
+    cpu_restore(&s->cpu, &s->snap);
+    s->cpu.console.capture_len = s->snap_output;
+    if (s->cpu.console.capture) s->cpu.console.capture[s->snap_output] = '\0';
+}
+
+// Drop the snapshot; the CPU shares its pages, so it is reset first
+static void side_drop_snapshot(struct Side *s) {
+    cpu_reset(&s->cpu);
+    cpu_snapshot_free(&s->snap);
+}
+
+/* ---------------- Comparing ---------------- */
+
+// Byte i of everything written to con: captured text, then the buffer
+static char output_at(const struct Console *con, size_t i) {
+    return i < con->capture_len ? con->capture[i] : con->buf[i - con->capture_len];
+}
+
+static int same_output(const struct Console *a, const struct Console *b) {
+    size_t n = a->capture_len + a->len;
+    if (n != b->capture_len + b->len) return 0;
+    for (size_t i = 0; i < n; i++) {
+        if (output_at(a, i) != output_at(b, i)) return 0;
+    }
+    return 1;
+}
+
+static int sides_agree(const struct Side *a, const struct Side *b) {
+    return cpu_state_hash(&a->cpu) == cpu_state_hash(&b->cpu) &&
+           same_output(&a->cpu.console, &b->cpu.console);
+}
+
+static const char *run_state(const struct CPU *cpu) {
+    return cpu->running ? "running" : cpu->fault ? cpu->fault : "halted";
+}
+
+static void print_field(const char *name, unsigned x, unsigned y) {
+    if (x != y) printf("    %-10s 0x%04X / 0x%04X\n", name, x, y);
+}
+
+// Everything architectural that differs between the two CPUs
+static void print_differences(const struct CPU *x, const struct CPU *y) {
+    char name[16];
+
+    for (int r = 0; r < 8; r++) {
+        snprintf(name, sizeof(name), "R%d", r);
+        print_field(name, x->gpr.reg[r], y->gpr.reg[r]);
+    }
+    print_field("IP", x->cu.IP, y->cu.IP);
+    print_field("SP", x->spr.SP, y->spr.SP);
+    print_field("depth", x->static_counter, y->static_counter);
+    print_field("ZR", x->cu.aluflags.zr, y->cu.aluflags.zr);
+    print_field("NG", x->cu.aluflags.ng, y->cu.aluflags.ng);
+    print_field("OV", x->cu.aluflags.ov, y->cu.aluflags.ov);
+    print_field("CY", x->cu.aluflags.cy, y->cu.aluflags.cy);
+    if (strcmp(run_state(x), run_state(y)) != 0) {
+        printf("    %-10s %s / %s\n", "state", run_state(x), run_state(y));
+    }
+
+    int differing = 0;
+    for (unsigned a = 0; a < ADDRESS_SPACE; a++) {
+        word_t u = cpu_peek(x, (word_t)a), v = cpu_peek(y, (word_t)a);
+        if (u == v) continue;
+        if (differing++ < VERIFY_MAX_WORDS) {
+            snprintf(name, sizeof(name), "M[0x%04X]", a);
+            print_field(name, u, v);
+        }
+    }
+    if (differing > VERIFY_MAX_WORDS) {
+        printf("    ... %d more memory words differ\n", differing - VERIFY_MAX_WORDS);
+    }
+    if (!same_output(&x->console, &y->console)) {
+        printf("    %-10s %zu / %zu bytes\n", "output",
+               x->console.capture_len + x->console.len, y->console.capture_len + y->console.len);
+    }
+}
+
+// a and b disagree after running at + n instructions but agreed after at:
+// find and print the instruction that made them differ
+static void report_divergence(struct Side *a, struct Side *b, const struct Image *img,
+                              const char *name, uint64_t at, uint64_t n) {
+    // Replay to the agreeing state and bisect from snapshots of it
+    side_load(a, img);
+    side_load(b, img);
+    side_advance(a, at);
+    side_advance(b, at);
+    side_save(a);
+    side_save(b);
+
+    uint64_t lo = 0, hi = n;   // the sides agree after lo instructions, not after hi
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        side_rewind(a);
+        side_rewind(b);
+        uint64_t ran_a = side_advance(a, mid), ran_b = side_advance(b, mid);
+        if (ran_a == ran_b && sides_agree(a, b)) lo = mid;
+        else hi = mid;
+    }
+
+    side_rewind(a);
+    side_advance(a, lo);
+    word_t ip = a->cpu.cu.IP, ir = cpu_peek(&a->cpu, ip);
+    printf("[VERIFY] %s: %s vs %s DIVERGED at instruction %llu\n", name,
+           BACKEND_NAMES[a->backend], BACKEND_NAMES[b->backend], (unsigned long long)(at + hi));
+    printf("  IP=%d IR=0x%04X (%s); after it, %s / %s:\n", ip, ir, instr_name(ir),
+           BACKEND_NAMES[a->backend], BACKEND_NAMES[b->backend]);
+
+    side_rewind(a);
+    side_rewind(b);
+    uint64_t ran_a = side_advance(a, hi), ran_b = side_advance(b, hi);
+    if (ran_a != ran_b) {
+        printf("    %-10s %llu / %llu\n", "executed",
+               (unsigned long long)ran_a, (unsigned long long)ran_b);
+    }
+    print_differences(&a->cpu, &b->cpu);
+
+    side_drop_snapshot(a);
+    side_drop_snapshot(b);
+}
+
+// Run img on both sides; returns 1 if they agreed at every check.
+// *executed gets the instructions compared.
+static int run_pair(const struct Verify *v, struct Side *a, struct Side *b,
+                    const struct Image *img, const char *name, uint64_t *executed) {
+    uint64_t at = 0;   // both sides ran this many instructions and agreed
+
+    side_load(a, img);
+    side_load(b, img);
+    while (at < v->limit) {
+        uint64_t n = v->limit - at < v->interval ? v->limit - at : v->interval;
+        uint64_t ran_a = side_advance(a, n), ran_b = side_advance(b, n);
+
+        if (ran_a != ran_b || !sides_agree(a, b)) {
+            report_divergence(a, b, img, name, at, n);
+            *executed = at;
+            return 0;
+        }
+        at += ran_a;
+        if (ran_a < n) break;   // both stopped the same way
+    }
+    *executed = at;
+    return 1;
+}
+
+/* ---------------- Random programs ---------------- */
+
+static uint32_t rng_state;
+
+static uint32_t next_random(void) {
+    rng_state ^= rng_state << 13;   // xorshift32
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static uint8_t random_below(uint32_t n) {
+    return (uint8_t)(next_random() % n);
+}
+
+// Random register values (often small, so LOAD/STORE addresses fall in the
+// code and on the I/O ports), then random instructions of every kind
+static size_t random_program(word_t *w) {
+    static const uint8_t ALU_OPS[] = { MOV, ADD, SUB, AND, OR, MUL, DIV };
+    size_t n = 0;
+
+    for (uint8_t r = 0; r < 8; r++) {
+        w[n++] = encodeI(MOVW, r, 0, 0);
+        w[n++] = (word_t)(random_below(3) ? next_random() % 80 : next_random());
+    }
+    while (n < VERIFY_RANDOM_WORDS) {
+        uint8_t r1 = random_below(8), r2 = random_below(8), imm = random_below(64);
+        uint8_t target = random_below(VERIFY_RANDOM_WORDS);
+
+        switch (random_below(16)) {
+        case 0: case 1: case 2:
+            w[n++] = encodeI(ALU_OPS[random_below(3)], r1, 0, imm);
+            break;
+        case 3: case 4:
+            w[n++] = encodeR(ALU_OPS[random_below(3)], r1, r2);
+            break;
+        case 5:
+            w[n++] = encodeI(ALU_OPS[3 + random_below(4)], r1, r2, 0);
+            break;
+        case 6:   // CMP with an immediate or a register
+            w[n++] = random_below(2) ? encodeI(SUB, r1, 2, imm) : encodeI(SUB, r1, 3, r2);
+            break;
+        case 7: case 8: case 9:
+            w[n++] = encodeJ(random_below(8), r1, target);
+            break;
+        case 10:
+            w[n++] = encodeI(JMP, 0, 0, target);
+            break;
+        case 11:
+            w[n++] = random_below(2) ? encodeI(CALL, 0, 0, target) : encodeI(RET, 0, 0, 0);
+            break;
+        case 12: case 13:
+            w[n++] = encodeI(random_below(2) ? LOAD : STORE, r1, r2, 0);
+            break;
+        case 14:
+            if (n + 2 > VERIFY_RANDOM_WORDS) break;
+            w[n++] = encodeI(MOVW, r1, 0, 0);
+            w[n++] = (word_t)next_random();
+            break;
+        default:
+            w[n++] = encodeI(random_below(4) ? NOP : HALT, 0, 0, 0);
+            break;
+        }
+    }
+    return n;
+}
+
+/* ---------------- Driver ---------------- */
+
+static int parse_backend(const char *name) {
+    for (int k = 0; k < BACKEND_COUNT; k++) {
+        if (strcmp(name, BACKEND_NAMES[k]) == 0) return k;
+    }
+    fprintf(stderr, "Error: Unknown backend '%s'\n", name);
+    return -1;
+}
+
+// Enable the backends named in a comma-separated list
+static int parse_backends(int *enabled, char *list) {
+    memset(enabled, 0, BACKEND_COUNT * sizeof(int));
+    for (char *tok = strtok(list, ","); tok; tok = strtok(NULL, ",")) {
+        int k = parse_backend(tok);
+        if (k < 0) return 0;
+        enabled[k] = 1;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    static struct Side sides[BACKEND_COUNT];
+    struct Verify v = { .interval = VERIFY_DEFAULT_INTERVAL };
+    int base = BACKEND_REFERENCE;
+    int enabled[BACKEND_COUNT] = { 0, 1, 1, 1, 1 };
+    uint32_t seed = 0;
+    long count = 1000;
+    int first_image = argc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            if ((base = parse_backend(argv[++i])) < 0) return 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            if (!parse_backends(enabled, argv[++i])) return 1;
+        } else if (strcmp(argv[i], "-N") == 0 && i + 1 < argc) {
+            v.interval = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            v.limit = strtoull(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-R") == 0 && i + 1 < argc) {
+            v.random = 1;
+            seed = (uint32_t)strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            count = atol(argv[++i]);
+        } else {
+            first_image = i;
+            break;
+        }
+    }
+    if (first_image == argc && !v.random) {
+        printf("CMPE220 Differential Verifier\n");
+        printf("Usage: %s [-a backend] [-b backend,...] [-N interval] [-n max_instr] "
+               "[-R seed] [-c count] [program.bin...]\n", argv[0]);
+        printf("  Compares -b (default: all others) against -a (default: reference)\n");
+        printf("  Backends: reference, step, interp, jit, lockstep\n");
+        return 1;
+    }
+    if (v.interval < 1) v.interval = 1;
+    if (v.limit == 0) v.limit = v.random ? VERIFY_RANDOM_LIMIT : VERIFY_DEFAULT_LIMIT;
+    rng_state = seed ? seed : 1;   // xorshift never leaves 0
+
+    enabled[base] = 0;
+    side_init(&sides[base], base);
+    for (int k = 0; k < BACKEND_COUNT; k++) {
+        if (enabled[k] && !side_init(&sides[k], k)) {
+            fprintf(stderr, "Note: backend '%s' is not available on this host\n", BACKEND_NAMES[k]);
+            enabled[k] = 0;
+        }
+    }
+
+    uint64_t total[BACKEND_COUNT] = { 0 };
+    long programs = 0, diverged[BACKEND_COUNT] = { 0 };
+    int status = 0;
+
+    for (int i = first_image; v.random ? programs < count : i < argc; i++, programs++) {
+        word_t words[VERIFY_RANDOM_WORDS];
+        struct Image img = { .words = words };
+        char name[64];
+
+        if (v.random) {
+            img.size = random_program(words);
+            snprintf(name, sizeof(name), "random #%ld", programs);
+        } else {
+            const char *err = image_open(argv[i], &img);
+            if (err) {
+                fprintf(stderr, "Error: '%s': %s\n", argv[i], err);
+                status = 1;
+                continue;
+            }
+            snprintf(name, sizeof(name), "%s", argv[i]);
+        }
+
+        for (int k = 0; k < BACKEND_COUNT; k++) {
+            if (!enabled[k]) continue;
+            uint64_t executed;
+            int agreed = run_pair(&v, &sides[base], &sides[k], &img, name, &executed);
+            total[k] += executed;
+            if (!agreed) {
+                diverged[k]++;
+                status = 1;
+            } else if (!v.random) {
+                printf("[VERIFY] %s: %s vs %s agree over %llu instructions (%s)\n", name,
+                       BACKEND_NAMES[base], BACKEND_NAMES[k], (unsigned long long)executed,
+                       run_state(&sides[k].cpu));
+            }
+        }
+        // Mapped image pages are shared until the CPUs let go of them
+        for (int k = 0; k < BACKEND_COUNT; k++) {
+            if (enabled[k] || k == base) cpu_reset(&sides[k].cpu);
+        }
+        image_close(&img);
+    }
+
+    for (int k = 0; k < BACKEND_COUNT; k++) {
+        if (!enabled[k]) continue;
+        printf("[VERIFY] %s vs %s: %ld program(s), %llu instructions, %ld divergent\n",
+               BACKEND_NAMES[base], BACKEND_NAMES[k], programs,
+               (unsigned long long)total[k], diverged[k]);
+    }
+    for (int k = 0; k < BACKEND_COUNT; k++) {
+        if (enabled[k] || k == base) side_free(&sides[k]);
+    }
+    return status;
+}